@@ -0,0 +1,520 @@
+///\file isrbench.c
+///
+///\brief Cycle-accurate ISR benchmark for satashnik.elf under simavr
+///
+/// Runs the firmware on a simulated ATmega8 with a minimal DS3234 attached
+/// to the SPI bus and INT0, walks the clock through boot, normal time display and
+/// the setup mode and measures every invocation of TIMER0_OVF_vect and
+/// ADC_vect from vector entry to the instruction following reti. The
+/// regulator is switched to PI for the last seconds.
+///
+/// Invocations are bucketed by the branch they took, which is recovered
+/// from firmware variables sampled at ISR exit. Variable
+/// addresses are taken from the symbol table via avr-nm ($NM).
+///
+/// Calls of the functions in funcs[] that the elf has are timed too, from
+/// the first instruction to the one after ret, less the interrupts taken
+/// meanwhile. bench/kernels.elf calls them and the code they replaced
+/// over their whole input range, for it only the function table is 
+/// reported.
+///
+/// Usage: isrbench satashnik.elf|kernels.elf [seconds]
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_spi.h>
+
+#define _BV(bit)        (1 << (bit))    //!< as in avr/io.h, for util.h and rtc.h
+
+#include "util.h"
+#include "rtc.h"
+
+#define F_CPU           8000000UL
+
+#define VECT_TIMER0_OVF 9           //!< ATmega8 vector numbers
+#define VECT_ADC        14
+#define VECT_SIZE       2           //!< rjmp vectors on ATmega8
+
+#define REG_PI          1           //!< as in voltage.h
+#define PI_AT_MS        12000       //!< switch the regulator to PI, after the button script
+
+#define NOSYM           0xffff
+
+/// Timer 0 overflow branches
+enum _t0_branch {
+    T0_IDLE = 0,            //!< nothing but the dot and counters
+    T0_FETCH,               //!< slow cycle: anodes off + frame slot fetch
+    T0_SELECT,              //!< anode on after the blanking interval
+    T0_BLANK,               //!< early blanking at the frame slot's blank tick
+    T0_FADE,                //!< crossfade cathode switch at the frame slot's fade tick
+    T0_NBRANCH
+};
+
+static const char *t0_names[T0_NBRANCH] = {
+    "idle", "frame fetch", "digit select", "early blanking", "crossfade switch"
+};
+
+/// ADC branches
+enum _adc_branch {
+    ADC_ACCUMULATE = 0,     //!< oversampling: conversion added up, early return
+    ADC_BANGBANG,           //!< regulator step, bang-bang
+    ADC_PI,                 //!< regulator step, PI
+    ADC_NBRANCH
+};
+
+static const char *adc_names[ADC_NBRANCH] = {
+    "accumulate only", "bang-bang step", "PI step"
+};
+
+typedef struct _stat {
+    uint32_t n;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} STAT;
+
+typedef struct _func {
+    const char *name;
+    uint16_t addr;              //!< byte address of the first instruction
+    int active;
+    uint16_t sp;                //!< SP right after the call
+    avr_cycle_count_t start;
+    avr_cycle_count_t isr;      //!< isr_cycles at the call
+    STAT stat;
+} FUNC_TRACK;
+
+typedef struct _isr {
+    uint16_t vector;            //!< byte address of the vector
+    int active;
+    uint16_t sp;                //!< SP right after entry
+    avr_cycle_count_t start;
+} ISR_TRACK;
+
+/// Firmware symbols, data-space addresses
+static struct {
+    uint16_t odd, cur;
+    uint16_t nacc, regulator;
+} sym;
+
+static STAT t0_stat[T0_NBRANCH];
+static STAT adc_stat[ADC_NBRANCH];
+
+/// Timed functions, the new routines with the reference code after them
+static FUNC_TRACK funcs[] = {
+    { "day_of_week" },
+    { "day_of_week_loop" },
+    { "tobcd16" },
+    { "tobcd16_div" },
+    { "voltage_getbcd" },
+    { "voltage_getbcd_div" },
+};
+
+#define NFUNCS (sizeof(funcs) / sizeof(funcs[0]))
+
+static int firmware;                //!< the elf is satashnik.elf
+static avr_cycle_count_t isr_cycles;    //!< spent in interrupt handlers so far
+
+static avr_t *avr;
+
+////
+//// Fake DS3234
+////
+
+#define RTCINT_PORT     'D'         //!< INT#/SQW is wired to PD2, INT0
+#define RTCINT_PIN      2
+
+static uint8_t rtc_regs[0x20];
+static int rtc_selected;
+static int rtc_nbyte;
+static uint8_t rtc_addr;
+static int rtc_write;
+static int rtc_sqw;                 //!< 1Hz square wave, low for the first half of a second
+static int rtc_pin = -1;            //!< level last driven on INT#/SQW
+
+static uint8_t bcd_inc(uint8_t x, uint8_t wrap) {
+    x++;
+    if ((x & 0x0f) >= 0x0a) x += 0x10 - 0x0a;
+    return x >= wrap ? 0 : x;
+}
+
+/// Does the time match alarm 1, A1M1..A1M4 in bit 7 of each alarm register
+static int rtc_alarm1_match() {
+    static const uint8_t time_reg[4] = { 0, 1, 2, 4 };    // seconds, minutes, hours, date
+    uint8_t a;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        a = rtc_regs[RTC_ALARM1 + i];
+        if (a & 0200) continue;
+        if (i == 3 && (a & 0100)) {
+            // DY/DT set: day of week
+            if ((a & 017) != rtc_regs[3]) return 0;
+        } else if ((a & 077) != (rtc_regs[time_reg[i]] & 077)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/// Drive INT#/SQW: the square wave when INTCN is clear, else low while
+/// an enabled alarm flag is set
+static void rtc_int_update() {
+    uint8_t control = rtc_regs[RTC_CONTROL];
+    int level;
+
+    if (control & _BV(RTC_INTCN)) {
+        level = (control & rtc_regs[RTC_STATUS] & BV2(1,0)) == 0;
+    } else {
+        level = rtc_sqw;
+    }
+    if (level != rtc_pin) {
+        rtc_pin = level;
+        avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(RTCINT_PORT), RTCINT_PIN), level);
+    }
+}
+
+/// Cycle timer every half second: count time on the falling edge of SQW
+static avr_cycle_count_t rtc_halfsecond(avr_t *avr, avr_cycle_count_t when, void *param) {
+    rtc_sqw = !rtc_sqw;
+    if (!rtc_sqw) {
+        rtc_regs[0] = bcd_inc(rtc_regs[0], 0x60);
+        if (rtc_regs[0] == 0) {
+            rtc_regs[1] = bcd_inc(rtc_regs[1], 0x60);
+            if (rtc_regs[1] == 0) {
+                rtc_regs[2] = bcd_inc(rtc_regs[2], 0x24);
+            }
+        }
+        if (rtc_alarm1_match()) {
+            rtc_regs[RTC_STATUS] |= _BV(0);     // A1F
+        }
+    }
+    rtc_int_update();
+    return when + F_CPU/2;
+}
+
+static void rtc_cs_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+    rtc_selected = value == 0;
+    rtc_nbyte = 0;
+}
+
+static void rtc_spi_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+    uint8_t reply = 0;
+
+    if (rtc_selected) {
+        if (rtc_nbyte == 0) {
+            rtc_addr = value & 0x1f;
+            rtc_write = (value & 0x80) != 0;
+        } else {
+            if (rtc_write && rtc_addr == RTC_STATUS) {
+                // alarm flags can only be cleared
+                rtc_regs[rtc_addr] = (value & ~BV2(1,0)) | (value & rtc_regs[rtc_addr] & BV2(1,0));
+            } else if (rtc_write) {
+                rtc_regs[rtc_addr] = value;
+            }
+            if (rtc_write) {
+                rtc_int_update();
+            }
+            reply = rtc_regs[rtc_addr];
+            rtc_addr = (rtc_addr + 1) & 0x1f;
+        }
+        rtc_nbyte++;
+    }
+
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_INPUT), reply);
+}
+
+////
+//// Script of button presses
+////
+
+typedef struct _press {
+    uint32_t ms;                //!< when
+    uint8_t pin;                //!< PORTC pin
+    uint8_t level;              //!< 0 = pressed
+} PRESS;
+
+#define BUTTON1 5               //!< SET
+#define BUTTON2 4               //!< +
+
+static const PRESS script[] = {
+    { 4000, BUTTON2, 0 },       // enter SET_HOUR, hours blink
+    { 4100, BUTTON2, 1 },
+    { 6000, BUTTON1, 0 },       // autorepeat hours
+    { 8000, BUTTON1, 1 },
+    { 9000, BUTTON2, 0 },       // SET_MINUTE
+    { 9100, BUTTON2, 1 },
+    { 9500, BUTTON2, 0 },       // SET_YEAR
+    { 9600, BUTTON2, 1 },
+    { 10000, BUTTON2, 0 },      // SET_MONTH
+    { 10100, BUTTON2, 1 },
+    { 10500, BUTTON2, 0 },      // SET_DAY
+    { 10600, BUTTON2, 1 },
+    { 11000, BUTTON2, 0 },      // back to normal, slow fade
+    { 11100, BUTTON2, 1 },
+    { 0, 0, 0 }
+};
+
+////
+//// Measurement
+////
+
+/// Address of a symbol, NOSYM if there is none
+static uint16_t nm_find(FILE *f, const char *name) {
+    char line[256], sname[200];
+    unsigned long addr;
+    char type;
+    size_t len = strlen(name);
+
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lx %c %199s", &addr, &type, sname) != 3) continue;
+        // static locals come out as name.NNNN
+        if (strncmp(sname, name, len) == 0 && (sname[len] == 0 || sname[len] == '.')) {
+            return addr & 0xffff;
+        }
+    }
+    return NOSYM;
+}
+
+/// Address of a symbol the benchmark needs, NOSYM with a warning if there is none
+static uint16_t nm_lookup(FILE *f, const char *name) {
+    uint16_t addr = nm_find(f, name);
+
+    if (addr == NOSYM) {
+        fprintf(stderr, "isrbench: symbol %s not found\n", name);
+    }
+    return addr;
+}
+
+static void load_symbols(const char *elf) {
+    char cmd[512];
+    const char *nm = getenv("NM");
+    FILE *p, *f = tmpfile();
+    int c, i;
+
+    snprintf(cmd, sizeof(cmd), "%s %s", nm ? nm : "avr-nm", elf);
+    p = popen(cmd, "r");
+    if (p == NULL || f == NULL) {
+        perror("isrbench");
+        exit(1);
+    }
+    while ((c = fgetc(p)) != EOF) fputc(c, f);
+    pclose(p);
+
+    firmware = nm_find(f, "display_render") != NOSYM;
+    if (firmware) {
+        sym.odd = nm_lookup(f, "odd");
+        sym.cur = nm_lookup(f, "cur");
+        sym.nacc = nm_lookup(f, "nacc");    // not there without oversampling
+        sym.regulator = nm_lookup(f, "regulator");
+    } else {
+        sym.odd = sym.cur = sym.nacc = sym.regulator = NOSYM;
+    }
+    for (i = 0; i < NFUNCS; i++) {
+        funcs[i].addr = nm_find(f, funcs[i].name);
+    }
+    fclose(f);
+}
+
+static uint8_t peek8(uint16_t addr) {
+    return addr == NOSYM ? 0 : avr->data[addr];
+}
+
+static uint16_t get_sp() {
+    return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+static void stat_add(STAT *s, uint32_t cycles) {
+    if (s->n == 0 || cycles < s->min) s->min = cycles;
+    if (cycles > s->max) s->max = cycles;
+    s->sum += cycles;
+    s->n++;
+}
+
+/// Recover the branch taken by TIMER0_OVF_vect from its state on exit
+static int t0_classify(ISR_TRACK *t) {
+    uint8_t slot = peek8(sym.odd) & 0x1f;
+    // FRAMESLOT cur: cathode, blank, dot, fade
+    uint8_t blank = sym.cur == NOSYM ? 0 : peek8(sym.cur + 1);
+    uint8_t fade = sym.cur == NOSYM ? 0 : peek8(sym.cur + 3);
+
+    if (slot == 0) {
+        return T0_FETCH;
+    }
+    if (slot == ANODE_BLANK_TICKS) {
+        return T0_SELECT;
+    }
+    if (slot == fade) {
+        return T0_FADE;
+    }
+    if (slot == blank) {
+        return T0_BLANK;
+    }
+    return T0_IDLE;
+}
+
+/// Recover the branch taken by ADC_vect, the oversampling counter 
+/// is only reset when the regulator steps
+static int adc_classify() {
+    if (sym.nacc != NOSYM && peek8(sym.nacc) != 0) {
+        return ADC_ACCUMULATE;
+    }
+    return peek8(sym.regulator) == REG_PI ? ADC_PI : ADC_BANGBANG;
+}
+
+static void track(ISR_TRACK *t, int is_t0) {
+    if (!t->active) {
+        if (avr->pc == t->vector) {
+            t->active = 1;
+            t->sp = get_sp();
+            t->start = avr->cycle;
+        }
+    } else if (get_sp() == t->sp + 2) {
+        // reti popped the return address
+        uint32_t cycles = avr->cycle - t->start;
+        t->active = 0;
+        isr_cycles += cycles;
+        if (is_t0) {
+            stat_add(&t0_stat[t0_classify(t)], cycles);
+        } else {
+            stat_add(&adc_stat[adc_classify()], cycles);
+        }
+    }
+}
+
+/// Time calls of the functions in funcs[], call after track()
+static void track_funcs() {
+    FUNC_TRACK *t;
+
+    for (t = funcs; t < funcs + NFUNCS; t++) {
+        if (t->addr == NOSYM) continue;
+        if (!t->active) {
+            if (avr->pc == t->addr) {
+                t->active = 1;
+                t->sp = get_sp();
+                t->start = avr->cycle;
+                t->isr = isr_cycles;
+            }
+        } else if (get_sp() == t->sp + 2) {
+            // ret popped the return address
+            t->active = 0;
+            stat_add(&t->stat, avr->cycle - t->start - (isr_cycles - t->isr));
+        }
+    }
+}
+
+static void report_funcs() {
+    FUNC_TRACK *t;
+
+    printf("%-26s %8s %8s %8s %8s\n", "function", "calls", "min", "avg", "worst");
+    for (t = funcs; t < funcs + NFUNCS; t++) {
+        if (t->stat.n == 0) continue;
+        printf("%-26s %8u %8u %8.1f %8u\n", t->name, t->stat.n, t->stat.min,
+            (double)t->stat.sum / t->stat.n, t->stat.max);
+    }
+}
+
+static void report(const char *isr, STAT *s, const char **names, int n) {
+    int i;
+
+    printf("%s\n", isr);
+    printf("  %-24s %8s %8s %8s %8s\n", "branch", "count", "min", "avg", "worst");
+    for (i = 0; i < n; i++) {
+        if (s[i].n == 0) {
+            printf("  %-24s %8s\n", names[i], "-");
+        } else {
+            printf("  %-24s %8u %8u %8.1f %8u\n", names[i], s[i].n, s[i].min,
+                (double)s[i].sum / s[i].n, s[i].max);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    elf_firmware_t f;
+    ISR_TRACK t0 = { VECT_TIMER0_OVF * VECT_SIZE };
+    ISR_TRACK adc = { VECT_ADC * VECT_SIZE };
+    const PRESS *next = script;
+    int pi = 0;
+    avr_cycle_count_t end;
+    int state;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s satashnik.elf|kernels.elf [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    load_symbols(argv[1]);
+
+    memset(&f, 0, sizeof(f));
+    if (elf_read_firmware(argv[1], &f) != 0) {
+        fprintf(stderr, "isrbench: cannot read %s\n", argv[1]);
+        return 1;
+    }
+    strcpy(f.mmcu, "atmega8");
+    f.frequency = F_CPU;
+
+    avr = avr_make_mcu_by_name(f.mmcu);
+    avr_init(avr);
+    avr_load_firmware(avr, &f);
+
+    end = (avr_cycle_count_t)F_CPU * (argc > 2 ? atoi(argv[2]) : 14);
+
+    // 12:34:50, sunday 2010-01-24
+    rtc_regs[0] = 0x50; rtc_regs[1] = 0x34; rtc_regs[2] = 0x12;
+    rtc_regs[3] = 0; rtc_regs[4] = 0x24; rtc_regs[5] = 0x01; rtc_regs[6] = 0x10;
+    rtc_regs[RTC_CONTROL] = _BV(RTC_INTCN);     // INTCN is set at power-on
+
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT),
+                            rtc_spi_hook, NULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 6),
+                            rtc_cs_hook, NULL);
+
+    rtc_sqw = 1;
+    rtc_int_update();
+    avr_cycle_timer_register(avr, F_CPU/2, rtc_halfsecond, NULL);
+
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), BUTTON1), 1);
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), BUTTON2), 1);
+
+    do {
+        if (next->ms != 0 && avr->cycle >= (avr_cycle_count_t)next->ms * (F_CPU/1000)) {
+            avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), next->pin), next->level);
+            next++;
+        }
+        if (!pi && sym.regulator != NOSYM && avr->cycle >= (avr_cycle_count_t)PI_AT_MS * (F_CPU/1000)) {
+            // what the console 'r' command does, less the bumpless transfer
+            avr->data[sym.regulator] = REG_PI;
+            pi = 1;
+        }
+
+        state = avr_run(avr);
+
+        track(&t0, 1);
+        track(&adc, 0);
+        track_funcs();
+    } while (state != cpu_Done && state != cpu_Crashed && avr->cycle < end);
+
+    if (state == cpu_Crashed) {
+        fprintf(stderr, "isrbench: simulated cpu crashed at pc=%04x\n", avr->pc);
+        return 1;
+    }
+
+    if (firmware) {
+        printf("%.1f simulated seconds, cycles from vector entry to return\n\n",
+               (double)avr->cycle / F_CPU);
+        report("TIMER0_OVF_vect", t0_stat, t0_names, T0_NBRANCH);
+        printf("\n");
+        report("ADC_vect", adc_stat, adc_names, ADC_NBRANCH);
+        printf("\n");
+    }
+    report_funcs();
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+///\file kernels.c
+///
+///\brief Calls the calendar and arithmetic routines and the code they 
+/// replaced (test/reference.c) over their whole input range, for 
+/// isrbench to time under simavr. Stops the simulation when done.
+///
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "util.h"
+#include "voltage.h"
+#include "test/reference.h"
+
+volatile uint16_t sink;     //!< keeps the results alive
+
+extern volatile uint16_t voltage;
+
+int main() {
+    uint8_t y, m, d, n;
+    uint16_t x;
+
+    for (y = 0; y < 100; y++) {
+        for (m = 1; m <= 12; m++) {
+            n = month_length(m, leap_year(y));
+            for (d = 1; d <= n; d++) {
+                sink = day_of_week(y, m, d);
+                sink = day_of_week_loop(y, m, d);
+            }
+        }
+    }
+
+    for (x = 0; x < 1000; x++) {
+        sink = tobcd16(x);
+        sink = tobcd16_div(x);
+    }
+
+    // interrupts stay off, nothing else writes voltage
+    for (x = 0; x < 1024; x++) {
+        voltage = x;
+        sink = voltage_getbcd();
+        sink = voltage_getbcd_div(x);
+    }
+
+    // simavr ends the run on sleep with interrupts off
+    cli();
+    sleep_cpu();
+    for (;;);
+}
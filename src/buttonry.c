@@ -7,6 +7,7 @@
 #include "util.h"
 #include "rtc.h"
 #include "modes.h"
+#include "sched.h"
 
 enum _setstates {
     SET_NONE = 0,
@@ -18,202 +19,291 @@ enum _setstates {
     SET_DAY,
 };
 
-/// buttons 1 and 2 states for debouncing
-static uint8_t button1_state, button2_state;
+/// Event state of a button, fed from buttons_state
+typedef struct _button {
+    uint8_t down;               //!< last debounced state seen
+    uint8_t held;               //!< samples held down, stops at BUTTON_LONG
+    uint8_t idle;               //!< samples since release, stops at 255
+    uint8_t period;             //!< current autorepeat period
+    uint8_t countdown;          //!< samples until the next BE_REPEAT
+} BUTTON;
 
-static uint8_t set_state;       //<! setup state, see enum _setstates 
+uint8_t buttons_integrator[2];
+volatile uint8_t buttons_state;
+volatile uint8_t buttons_clock;
 
-RTC_TIME rtc_time;              //<! current time values, used only during setup 
+static BUTTON buttons[2];
+static uint8_t buttons_last;    //!< buttons_clock when buttonry_tick() last ran
 
-#define DDRBUTTONS  DDRC
-#define PORTBUTTONS PORTC
-#define PINBUTTONS  PINC
+/// Event queue, each entry is button number << 4 | event
+static uint8_t queue[BUTTON_QUEUE];
+static uint8_t queue_head, queue_tail;
 
-#define BUTTON1     5
-#define BUTTON2     4
+static uint8_t set_state;       //<! setup state, see enum _setstates
 
+RTC_TIME rtc_time;              //<! current time values, used only during setup
 
-/// Catch button press and release moments, call handler
-void debounce(uint8_t port, uint8_t* state, void (*handler)(uint8_t)) {
-    if (*state && !port) handler(1);
-    if (!*state && port) handler(0);
-    *state = port;
+/// Queue an event, it's dropped if the queue is full
+static void button_event_put(uint8_t n, uint8_t event) {
+    uint8_t next = (queue_head + 1) & (BUTTON_QUEUE - 1);
+
+    if (next != queue_tail) {
+        queue[queue_head] = (n << 4) | event;
+        queue_head = next;
+    }
+}
+
+/// Take the next event from the queue
+/// \return button number << 4 | event, BE_NONE if the queue is empty
+static uint8_t button_event_get() {
+    uint8_t e;
+
+    if (queue_tail == queue_head) {
+        return BE_NONE;
+    }
+    e = queue[queue_tail];
+    queue_tail = (queue_tail + 1) & (BUTTON_QUEUE - 1);
+    return e;
+}
+
+/// Make events for button n
+/// \param down debounced state
+/// \param elapsed samples since last call
+static void button_update(uint8_t n, uint8_t down, uint8_t elapsed) {
+    BUTTON *b = &buttons[n];
+
+    if (down != b->down) {
+        b->down = down;
+        if (down) {
+            button_event_put(n, BE_PRESS);
+            if (b->idle < BUTTON_DOUBLE) {
+                button_event_put(n, BE_DOUBLE);
+            }
+            b->held = 0;
+            b->period = BUTTON_REPEAT_START;
+            b->countdown = BUTTON_REPEAT_DELAY;
+        } else {
+            button_event_put(n, BE_RELEASE);
+            b->idle = 0;
+        }
+        return;
+    }
+
+    if (!down) {
+        b->idle = b->idle > 255 - elapsed ? 255 : b->idle + elapsed;
+        return;
+    }
+
+    if (b->held < BUTTON_LONG) {
+        b->held += elapsed;
+        if (b->held >= BUTTON_LONG) {
+            b->held = BUTTON_LONG;
+            button_event_put(n, BE_LONG);
+        }
+    }
+
+    if (elapsed < b->countdown) {
+        b->countdown -= elapsed;
+    } else {
+        // every repeat comes a quarter sooner than the one before
+        button_event_put(n, BE_REPEAT);
+        b->period -= b->period >> 2;
+        if (b->period < BUTTON_REPEAT_MIN) {
+            b->period = BUTTON_REPEAT_MIN;
+        }
+        b->countdown = b->period;
+    }
 }
 
 /// Initialize ports and variables
 void buttons_init() {
     DDRBUTTONS &= ~BV2(BUTTON1,BUTTON2);
     PORTBUTTONS |= BV2(BUTTON1,BUTTON2);
-    button1_state = button2_state = 0;
+    buttons[0].idle = buttons[1].idle = 255;
 }
 
-
-#define set_blinkhandler(x) { cli();\
-                              if (blinkhandler == NULL) {\
-                                blinkhandler = x;\
-                                skip = 1;\
-                              }\
-                              sei();\
-                            }
-
+/// In VOLTAGE mode the dot shows the saving mode
 void set_voltage_dot() {
     if (mode_get() == VOLTAGE) {
-        if (savingmode_get() == SAVENIGHT) {
-            dotmode_set(DOT_BLINK);
-        } else {
-            dotmode_set(DOT_OFF);
+        switch (savingmode_get()) {
+            case SAVENIGHT:
+                dotmode_set(DOT_BLINK);
+                break;
+            case SAVEDARK:
+                dotmode_set(DOT_ON);
+                break;
+            default:
+                dotmode_set(DOT_OFF);
+                break;
         }
     }
 }
 
-/// Handler for button 1: "SET"
-void button1_handler(uint8_t on) {
-    static uint8_t skip = 0;
-    
-    if (on) {
-        blinkmode_set(blinkmode_get() | 0200);  // don't blink while button is being depressed
+/// Step the value being set, on press and autorepeat of button 1
+static void button1_step() {
+    switch (set_state) {
+        case SET_HOUR:
+            rtc_time.hour = bcd_increment(rtc_time.hour);
 
-        if (skip > 0) {
-            skip--;
-            return;
-        }
-        
-        switch (set_state) {
-            case SET_NONE:
+            if (rtc_time.hour == 0x24) rtc_time.hour = 0;
+
+            rtc_xhour(rtc_time.hour);
+
+            fadeto((get_display_value() & 0377) | (rtc_time.hour << 8));
+            break;
+
+        case SET_MINUTE:
+            rtc_time.minute = bcd_increment(rtc_time.minute);
+            if (rtc_time.minute == 0x60) rtc_time.minute = 0;
+            rtc_xminute(rtc_time.minute);
+
+            fadeto((get_display_value() & 0xff00) | rtc_time.minute);
+            break;
+
+        case SET_YEAR:
+            rtc_time.year = bcd_increment(rtc_time.year);
+            rtc_xyear(rtc_time.year);
+
+            rtc_xdow(day_of_week(frombcd(rtc_time.year), frombcd(rtc_time.month), frombcd(rtc_time.day)));
+
+            fadeto(0x2000 + rtc_time.year);
+            break;
+
+        case SET_MONTH:
+            rtc_time.month = bcd_increment(rtc_time.month);
+            if (rtc_time.month == 0x13) rtc_time.month = 1;
+            rtc_xmonth(rtc_time.month);
+
+            rtc_xdow(day_of_week(frombcd(rtc_time.year), frombcd(rtc_time.month), frombcd(rtc_time.day)));
+
+            fadeto(maketime(rtc_time.day, rtc_time.month));
+            break;
+
+        case SET_DAY:
+            rtc_time.day = bcd_increment(rtc_time.day);
+            if (rtc_time.day > days_in_month_bcd(rtc_time.year, rtc_time.month)) {
+                rtc_time.day = 1;
+            }
+            rtc_xday(rtc_time.day);
+
+            rtc_xdow(day_of_week(frombcd(rtc_time.year), frombcd(rtc_time.month), frombcd(rtc_time.day)));
+
+            fadeto(maketime(rtc_time.day, rtc_time.month));
+            break;
+    }
+    sched_signal(SCHED_RTC);    // have task_rtc() read the new time
+}
+
+/// Leave setup, the time and date stepped so far are already in the RTC
+static void setup_end() {
+    set_state = SET_NONE;
+    blinkmode_set(BLINK_NONE);
+    fade_set(FADE_SLOW);
+    dotmode_set(DOT_BLINK);
+}
+
+/// Handler for button 1: "SET". A double press goes straight back to HH:MM.
+/// \param event \see _button_event
+void button1_handler(uint8_t event) {
+    switch (event) {
+        case BE_PRESS:
+            blinkmode_set(blinkmode_get() | 0200);  // don't blink while button is being depressed
+            if (set_state == SET_NONE) {
                 mode_next();
                 set_voltage_dot();
-                skip = 1;
-                break;
-                
-            case SET_HOUR:
-                set_blinkhandler(button1_handler);
-                
-                rtc_time.hour = bcd_increment(rtc_time.hour);
-
-                if (rtc_time.hour == 0x24) rtc_time.hour = 0;
-                
-                rtc_xhour(rtc_time.hour);
-                
-                fadeto((get_display_value() & 0377) | (rtc_time.hour << 8));
-                break;
-                
-            case SET_MINUTE:
-                set_blinkhandler(button1_handler);
-                
-                rtc_time.minute = bcd_increment(rtc_time.minute);
-                if (rtc_time.minute == 0x60) rtc_time.minute = 0;
-                rtc_xminute(rtc_time.minute);
-                
-                fadeto((get_display_value() & 0xff00) | rtc_time.minute);
-                break;
-                
-            case SET_YEAR:
-                set_blinkhandler(button1_handler);
-                
-                rtc_time.year = bcd_increment(rtc_time.year);
-                rtc_xyear(rtc_time.year);
-
-                rtc_xdow(day_of_week(frombcd(rtc_time.year), frombcd(rtc_time.month), frombcd(rtc_time.day)));
-
-                fadeto(0x2000 + rtc_time.year);
-                break;     
-                       
-            case SET_MONTH:
-                set_blinkhandler(button1_handler);
-
-                rtc_time.month = bcd_increment(rtc_time.month);
-                if (rtc_time.month == 0x13) rtc_time.month = 1;                
-                rtc_xmonth(rtc_time.month);
-
-                rtc_xdow(day_of_week(frombcd(rtc_time.year), frombcd(rtc_time.month), frombcd(rtc_time.day)));
-                
-                fadeto(maketime(rtc_time.day, rtc_time.month));
-                break;
-            
-            case SET_DAY:
-                set_blinkhandler(button1_handler);
-                
-                rtc_time.day = bcd_increment(rtc_time.day);
-                if (rtc_time.day > days_in_month_bcd(rtc_time.year, rtc_time.month)) {
-                    rtc_time.day = 1;
-                }
-                rtc_xday(rtc_time.day);
-                
-                rtc_xdow(day_of_week(frombcd(rtc_time.year), frombcd(rtc_time.month), frombcd(rtc_time.day)));
-                
-                fadeto(maketime(rtc_time.day, rtc_time.month));
-                break;
-        }
-    } else {
-        blinkmode_set(blinkmode_get() & 0177);  // re-enable blinking
-        cli(); blinkhandler = NULL; skip = 0; sei();
+            } else {
+                button1_step();
+            }
+            break;
+        case BE_REPEAT:
+            if (set_state != SET_NONE) {
+                button1_step();
+            }
+            break;
+        case BE_RELEASE:
+            blinkmode_set(blinkmode_get() & 0177);  // re-enable blinking
+            break;
+        case BE_DOUBLE:
+            if (set_state == SET_NONE) {
+                mode_set(HHMM);     // the second BE_PRESS has already stepped on
+            }
+            break;
+        default:
+            break;
     }
 }
 
-/// Handler for button 2, "+"
-void button2_handler(uint8_t on) {
-    if (on) {
-        switch (set_state) {
-            case SET_NONE:
-                switch (mode_get()) {
-                case MMSS:
-                    rtc_xseconds(0);
-                    break;
-                case HHMM:
-                    set_state = SET_HOUR;
-                    blinkmode_set(BLINK_HH);
-                    fade_set(FADE_OFF);
-                    dotmode_set(DOT_ON);
-                    
-                    rtc_time.hour = rtc_xhour(-1);
-                    rtc_time.minute = rtc_xminute(-1); 
-                    fadeto(maketime(rtc_time.hour, rtc_time.minute));
-                    break;
-                case VOLTAGE:
-                    savingmode_next();
-                    set_voltage_dot();
-                    break;
-                default:
-                    break;
-                }
-                break;
-            case SET_HOUR:
-                set_state = SET_MINUTE;
-                blinkmode_set(BLINK_MM);
-                break;
-            case SET_MINUTE:
-                set_state = SET_YEAR;
-                blinkmode_set(BLINK_ALL);
-                dotmode_set(DOT_OFF);
-                rtc_time.year = rtc_xyear(-1);
-                fadeto(0x2000 + rtc_time.year);
-                break;
-            case SET_YEAR:
-                set_state = SET_MONTH;
-                blinkmode_set(BLINK_MM);
-                
-                rtc_time.month = rtc_xmonth(-1);
-                if (rtc_time.month == 0) rtc_time.month = 1;
-                
-                rtc_time.day   = rtc_xday(-1);
-                if (rtc_time.day == 0) rtc_time.day = 1;
-                
-                fadeto(maketime(rtc_time.day, rtc_time.month));
+/// Handler for button 2, "+". Holding it past the hour leaves setup.
+/// \param event \see _button_event
+void button2_handler(uint8_t event) {
+    if (event == BE_LONG) {
+        // not in SET_HOUR: the press that entered setup may still be held
+        if (set_state > SET_HOUR) {
+            setup_end();
+        }
+        return;
+    }
+    if (event != BE_PRESS) {
+        return;
+    }
+
+    switch (set_state) {
+        case SET_NONE:
+            switch (mode_get()) {
+            case MMSS:
+                rtc_xseconds(0);
+                sched_signal(SCHED_RTC);
                 break;
-            case SET_MONTH:
-                set_state = SET_DAY;
+            case HHMM:
+                set_state = SET_HOUR;
                 blinkmode_set(BLINK_HH);
+                fade_set(FADE_OFF);
+                dotmode_set(DOT_ON);
+
+                rtc_time.hour = rtc_xhour(-1);
+                rtc_time.minute = rtc_xminute(-1);
+                fadeto(maketime(rtc_time.hour, rtc_time.minute));
+                break;
+            case VOLTAGE:
+                savingmode_next();
+                set_voltage_dot();
                 break;
-            case SET_DAY:
             default:
-                set_state = SET_NONE;
-                blinkmode_set(BLINK_NONE);
-                fade_set(FADE_SLOW);
-                dotmode_set(DOT_BLINK);
                 break;
-        }
-    } else {
-        cli(); blinkhandler = NULL; sei();
+            }
+            break;
+        case SET_HOUR:
+            set_state = SET_MINUTE;
+            blinkmode_set(BLINK_MM);
+            break;
+        case SET_MINUTE:
+            set_state = SET_YEAR;
+            blinkmode_set(BLINK_ALL);
+            dotmode_set(DOT_OFF);
+            rtc_time.year = rtc_xyear(-1);
+
+            // the whole date, day_of_week() needs it when the year is stepped
+            rtc_time.month = rtc_xmonth(-1);
+            if (rtc_time.month == 0) rtc_time.month = 1;
+
+            rtc_time.day   = rtc_xday(-1);
+            if (rtc_time.day == 0) rtc_time.day = 1;
+
+            fadeto(0x2000 + rtc_time.year);
+            break;
+        case SET_YEAR:
+            set_state = SET_MONTH;
+            blinkmode_set(BLINK_MM);
+            fadeto(maketime(rtc_time.day, rtc_time.month));
+            break;
+        case SET_MONTH:
+            set_state = SET_DAY;
+            blinkmode_set(BLINK_HH);
+            break;
+        case SET_DAY:
+        default:
+            setup_end();
+            break;
     }
 }
 
@@ -221,7 +311,41 @@ uint8_t is_setting() {
     return set_state != SET_NONE;
 }
 
+/// Return 1 if any button is held down, for when TIMER0_OVF_vect isn't running.
+/// The press is swallowed, only the release will be seen by buttonry_tick().
+uint8_t buttons_held() {
+    uint8_t n, down;
+
+    for (n = 0; n < 2; n++) {
+        down = (PINBUTTONS & (n == 0 ? _BV(BUTTON1) : _BV(BUTTON2))) == 0;
+        cli();
+        buttons_integrator[n] = down ? BUTTON_INTEGRATE : 0;
+        buttons_state = down ? buttons_state | _BV(n) : buttons_state & ~_BV(n);
+        sei();
+        buttons[n].down = down;
+        buttons[n].held = BUTTON_LONG;
+        buttons[n].countdown = 255;
+    }
+
+    return buttons_state != 0;
+}
+
+/// Main loop task, runs as often as buttons are sampled. Dispatches button events to the handlers.
 void buttonry_tick() {
-    debounce(PINBUTTONS & _BV(BUTTON1), &button1_state, button1_handler);
-    debounce(PINBUTTONS & _BV(BUTTON2), &button2_state, button2_handler);
+    uint8_t now = buttons_clock;
+    uint8_t elapsed = now - buttons_last;
+    uint8_t state = buttons_state;
+    uint8_t e;
+
+    buttons_last = now;
+    button_update(0, (state & _BV(0)) != 0, elapsed);
+    button_update(1, (state & _BV(1)) != 0, elapsed);
+
+    while ((e = button_event_get()) != BE_NONE) {
+        if ((e >> 4) == 0) {
+            button1_handler(e & 017);
+        } else {
+            button2_handler(e & 017);
+        }
+    }
 }
@@ -1,14 +1,69 @@
 /// \file
 /// \brief Button setup-related stuff
 ///
+/// Buttons are debounced by an integrator sampled from TIMER0_OVF_vect, see
+/// buttons_sample(). buttonry_tick() turns the debounced state into
+/// events and hands them to button1_handler() and button2_handler().
+/// A double press of SET returns to HH:MM, a long press of "+" leaves setup.
 #ifndef _BUTTONRY_H
 #define _BUTTONRY_H
 
-void debounce(uint8_t port, uint8_t* state, void (*handler)(uint8_t));
+#define DDRBUTTONS  DDRC
+#define PORTBUTTONS PORTC
+#define PINBUTTONS  PINC
+
+#define BUTTON1     5
+#define BUTTON2     4
+
+#define BUTTON_SAMPLE       8   //!< slow cycles between samples, 156 samples/s, power of 2
+#define BUTTON_INTEGRATE    4   //!< samples in a row that make a press or release, 25ms
+#define BUTTON_LONG         156 //!< samples held for BE_LONG, 1s
+#define BUTTON_DOUBLE       62  //!< max samples from release to press for BE_DOUBLE, 0.4s
+#define BUTTON_REPEAT_DELAY 78  //!< samples held before the first BE_REPEAT, 0.5s
+#define BUTTON_REPEAT_START 39  //!< first autorepeat period, 0.25s
+#define BUTTON_REPEAT_MIN   4   //!< fastest autorepeat period, 39 steps/s
+#define BUTTON_QUEUE        8   //!< event queue length, power of 2
+
+/// Button events, what button1_handler() and button2_handler() get
+enum _button_event {
+    BE_NONE = 0,
+    BE_PRESS,
+    BE_RELEASE,
+    BE_LONG,                    //!< held for BUTTON_LONG
+    BE_DOUBLE,                  //!< follows BE_PRESS that came soon after a release
+    BE_REPEAT,                  //!< autorepeat while held, faster and faster
+};
+
+extern uint8_t buttons_integrator[2];
+extern volatile uint8_t buttons_state;  //!< debounced, bit n set when button n+1 is down
+extern volatile uint8_t buttons_clock;  //!< counts samples
+
+/// Integrate one sample of button n
+static inline void button_integrate(uint8_t n, uint8_t down) {
+    if (down) {
+        if (buttons_integrator[n] < BUTTON_INTEGRATE && ++buttons_integrator[n] == BUTTON_INTEGRATE) {
+            buttons_state |= _BV(n);
+        }
+    } else if (buttons_integrator[n] > 0 && --buttons_integrator[n] == 0) {
+        buttons_state &= ~_BV(n);
+    }
+}
+
+/// Sample buttons, call from TIMER0_OVF_vect every BUTTON_SAMPLE slow cycles
+static inline void buttons_sample() {
+    uint8_t pins = PINBUTTONS;
+
+    button_integrate(0, (pins & _BV(BUTTON1)) == 0);
+    button_integrate(1, (pins & _BV(BUTTON2)) == 0);
+    buttons_clock++;
+}
+
 void buttons_init();
-void button1_handler(uint8_t on);
-void button2_handler(uint8_t on);
+void button1_handler(uint8_t event);
+void button2_handler(uint8_t event);
 uint8_t is_setting();
+uint8_t buttons_held();
+void set_voltage_dot();
 void buttonry_tick();
 
 #endif
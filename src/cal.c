@@ -1,50 +1,140 @@
+///\file cal.c
+///\brief Daylight saving time
+///
+/// Each rule set is a pair of DST_RULEs. When the year changes, the day of
+/// each transition is worked out once, after that update_daylight() only
+/// compares the snapshot against it. A transition is applied at or after
+/// its hour, once.
+
 #include <inttypes.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
 
 #include "util.h"
-#include "cal.h"
 #include "rtc.h"
+#include "cal.h"
+
+/// Transitions of each rule set but DST_NONE
+static const DST_RULE dst_rules[NDSTZONES - 1][2] PROGMEM = {
+    { { 0x03, DST_LAST, 0x02, +1 }, { 0x10, DST_LAST, 0x03, -1 } },     // DST_EU
+    { { 0x03, 2, 0x02, +1 }, { 0x11, 1, 0x02, -1 } },                   // DST_US
+};
+
+static uint8_t dst_zone = DST_ZONE;
+static uint8_t dst_year = 0xff;     //!< BCD year dst_day is valid for, 0xff = none
+static uint8_t dst_day[2];          //!< BCD day of month of each transition in dst_year
+static uint8_t dst_done;            //!< bit per transition already applied in dst_year
+static uint8_t dst_kept_year = 0xff;    //!< BCD year of dst_kept, \see dst_restore()
+static uint8_t dst_kept;            //!< transitions applied in dst_kept_year before a reset
+
+/// Has now reached transition i of the current rule set in dst_year.
+/// BCD values compare like binary ones.
+static uint8_t dst_reached(const RTC_TIME *now, uint8_t i) {
+    const DST_RULE *rule = &dst_rules[dst_zone - 1][i];
+    uint8_t month = pgm_read_byte(&rule->month);
+
+    if (now->month != month) {
+        return now->month > month;
+    }
+    if (now->day != dst_day[i]) {
+        return now->day > dst_day[i];
+    }
+    return now->hour >= pgm_read_byte(&rule->hour);
+}
+
+/// Find the days of the transitions of the current rule set in the year of now.
+/// Transitions that are already past are taken as applied, the RTC is 
+/// expected to keep local time when the year is new or the rules change.
+/// So are those dst_restore() says were applied before a reset, lest the
+/// hour repeated after falling back is set back again.
+static void dst_plan(const RTC_TIME *now) {
+    const DST_RULE *rule = dst_rules[dst_zone - 1];
+    uint8_t y = frombcd(now->year);
+    uint8_t i, m, week, day;
+
+    dst_done = 0;
+    for (i = 0; i < 2; i++, rule++) {
+        m = frombcd(pgm_read_byte(&rule->month));
+        week = pgm_read_byte(&rule->week);
+
+        // first Sunday, then n-th or last
+        day = 1 + (7 - day_of_week(y, m, 1)) % 7;
+        if (week == DST_LAST) {
+            day += 21;
+            if (day + 7 <= month_length(m, leap_year(y))) {
+                day += 7;
+            }
+        } else {
+            day += 7 * (week - 1);
+        }
+        dst_day[i] = tobcd(day);
+
+        if (dst_reached(now, i)) {
+            dst_done |= _BV(i);
+        }
+    }
 
-static uint8_t daylight_adjusted = 0; //!< a flag that tells that DST adjustment took place already
-
-/// Update DST: 
-/// 02:00->03:00 on the last sunday of March
-/// 03:00->02:00 on the last sunday of October
-/// 
-/// And try to do this only once..
-void update_daylight(uint16_t time) {
-    if (time == 0x0000) daylight_adjusted = 0;
-    
-    if (daylight_adjusted) return;
-    
-    if (time == 0x0200 || time == 0x0300) {
-        if (rtc_xdow(-1) == 0) {
-            switch (rtc_xmonth(-1)) {
-                case 3:
-                    if (rtc_xday(-1) > 0x24) {
-                        // last sunday of march
-                        if (time == 0x0200) {
-                            rtc_xhour(3);
-                            daylight_adjusted = 1;
-                        }
-                    } else {
-                        daylight_adjusted = 1;
-                    }
-                    break;
-                case 0x10:
-                    if (rtc_xday(-1) > 0x24) {
-                        // last sunday of october
-                        if (time == 0x0300) {
-                            rtc_xhour(2);
-                            daylight_adjusted = 1;
-                        }
-                    } else {
-                        daylight_adjusted = 1;
-                    }  
-                    break;
-                default:
-                    daylight_adjusted = 1; 
-                    break;
+    if (now->year == dst_kept_year) {
+        dst_done |= dst_kept;
+    }
+    dst_year = now->year;
+}
+
+/// Apply DST transition if one is due. Call at least once a minute, 
+/// a transition that was missed is caught up with later the same day.
+/// Every transition is applied once a year, so the hour repeated after
+/// falling back is left alone.
+/// \param now current time snapshot, hour is updated if adjusted
+void update_daylight(RTC_TIME *now) {
+    const DST_RULE *rule;
+    uint8_t i;
+    int8_t hour;
+
+    if (dst_zone == DST_NONE) return;
+
+    if (now->year != dst_year) {
+        dst_plan(now);
+    }
+    if (dst_done == BV2(1,0)) return;
+
+    rule = dst_rules[dst_zone - 1];
+    for (i = 0; i < 2; i++, rule++) {
+        if ((dst_done & _BV(i)) == 0 && dst_reached(now, i)) {
+            dst_done |= _BV(i);
+
+            // the shift never crosses midnight unless the whole day was missed
+            hour = frombcd(now->hour) + (int8_t) pgm_read_byte(&rule->shift);
+            if (now->day == dst_day[i] && hour >= 0 && hour < 24) {
+                now->hour = tobcd(hour);
+                rtc_xhour(now->hour);
             }
         }
     }
 }
+
+uint8_t dst_set(uint8_t zone) {
+    if (zone >= NDSTZONES) {
+        return 0;
+    }
+    if (zone != dst_zone) {
+        dst_zone = zone;
+        dst_year = 0xff;
+        dst_kept_year = 0xff;
+    }
+    return 1;
+}
+
+uint8_t dst_get() {
+    return dst_zone;
+}
+
+uint8_t dst_applied(uint8_t *year) {
+    *year = dst_year;
+    return dst_done;
+}
+
+void dst_restore(uint8_t year, uint8_t done) {
+    dst_kept_year = year;
+    dst_kept = done;
+    dst_year = 0xff;
+}
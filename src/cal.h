@@ -1,6 +1,41 @@
 #ifndef _CAL_H_
 #define _CAL_H_
 
-void update_daylight(uint16_t time);
+/// Daylight saving time rule sets
+enum _dst_zone {
+    DST_NONE = 0,               //!< no adjustment
+    DST_EU,                     //!< last Sunday of March and October, 01:00 UTC
+    DST_US,                     //!< second Sunday of March, first Sunday of November, 02:00 local
+    NDSTZONES
+};
+
+#ifndef DST_ZONE
+#define DST_ZONE    DST_EU      //!< rule set used until dst_set() is called
+#endif
+
+#define DST_LAST    5           //!< DST_RULE week: last one in the month
+
+/// One DST transition: on the week'th Sunday of month at hour the clock is set to hour + shift
+typedef struct _dst_rule {
+    uint8_t month;              //!< BCD month
+    uint8_t week;               //!< 1..4 or DST_LAST
+    uint8_t hour;               //!< BCD local hour the transition happens at
+    int8_t shift;               //!< +1 spring forward, -1 fall back
+} DST_RULE;
+
+void update_daylight(RTC_TIME *now);
+
+/// Select DST rule set, \see _dst_zone.
+/// \return 0 if zone is out of range
+uint8_t dst_set(uint8_t zone);
+
+uint8_t dst_get();
+
+/// Transitions applied so far, bit per transition, for keeping across resets.
+/// \param year set to the BCD year they were applied in, 0xff if none yet
+uint8_t dst_applied(uint8_t *year);
+
+/// Take transitions as applied in BCD year, as dst_applied() said before a reset
+void dst_restore(uint8_t year, uint8_t done);
 
 #endif
@@ -0,0 +1,42 @@
+///\file hal.h
+///\brief Thin hardware abstraction for what a register file can't simulate
+///
+/// GPIO, ADC and timer registers are used directly. In a HOST build they 
+/// live in a simulated register file (host/avr/io.h) and the interrupts are 
+/// driven by host/hal_host.c. SPI transfers and sleeping need behaviour 
+/// behind them, so they go through here. On the AVR these are inlined.
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#ifdef HOST
+
+uint8_t hal_spi_xfer(uint8_t b);
+void hal_spi_end();
+void hal_sleep();
+
+#else
+
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+/// Exchange a byte over SPI, chip select is up to the caller
+static inline uint8_t hal_spi_xfer(uint8_t b) {
+    SPDR = b;
+    while (!(SPSR & _BV(SPIF)));
+    return SPDR;
+}
+
+/// SPI transaction is over, chip select is already released
+static inline void hal_spi_end() {
+}
+
+/// Sleep in the mode set by set_sleep_mode() until an interrupt
+static inline void hal_sleep() {
+    sleep_enable();
+    sleep_cpu();
+    sleep_disable();
+}
+
+#endif
+
+#endif
@@ -0,0 +1,17 @@
+///\file host/avr/eeprom.h
+///\brief EEPROM variables are ordinary memory in the HOST build
+#ifndef _HOST_AVR_EEPROM_H_
+#define _HOST_AVR_EEPROM_H_
+
+#include <inttypes.h>
+#include <string.h>
+
+#define EEMEM
+
+#define eeprom_read_block(dst, src, n)  memcpy((dst), (src), (n))
+#define eeprom_write_block(src, dst, n) memcpy((dst), (src), (n))
+#define eeprom_read_byte(p)             (*(const uint8_t *)(p))
+#define eeprom_write_byte(p, b)         (*(uint8_t *)(p) = (b))
+#define eeprom_is_ready()               1
+
+#endif
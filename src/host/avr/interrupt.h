@@ -0,0 +1,13 @@
+///\file host/avr/interrupt.h
+///\brief Interrupts for the HOST build, ISRs are called by hal_host.c
+#ifndef _HOST_AVR_INTERRUPT_H_
+#define _HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)    void vector(void); void vector(void)
+
+#define sei()   (SREG |= _BV(SREG_I))
+#define cli()   (SREG &= ~_BV(SREG_I))
+
+#endif
@@ -0,0 +1,138 @@
+///\file host/avr/io.h
+///\brief Simulated ATmega8 register file for the HOST build, \see hal_host.c
+#ifndef _HOST_AVR_IO_H_
+#define _HOST_AVR_IO_H_
+
+#include <inttypes.h>
+
+extern volatile uint8_t hal_io[64];     //!< I/O space, ATmega8 I/O addresses
+
+#define _SFR_IO8(a)     (hal_io[a])
+#define _SFR_IO16(a)    (*(volatile uint16_t *) &hal_io[a])
+#define _BV(bit)        (1 << (bit))
+
+#define TWBR    _SFR_IO8(0x00)
+#define ADCL    _SFR_IO8(0x04)
+#define ADCH    _SFR_IO8(0x05)
+#define ADC     _SFR_IO16(0x04)
+#define ADCW    _SFR_IO16(0x04)
+#define ADCSRA  _SFR_IO8(0x06)
+#define ADMUX   _SFR_IO8(0x07)
+#define ACSR    _SFR_IO8(0x08)
+#define UBRRL   _SFR_IO8(0x09)
+#define UCSRB   _SFR_IO8(0x0A)
+#define UCSRA   _SFR_IO8(0x0B)
+#define UDR     _SFR_IO8(0x0C)
+#define SPCR    _SFR_IO8(0x0D)
+#define SPSR    _SFR_IO8(0x0E)
+#define SPDR    _SFR_IO8(0x0F)
+#define PIND    _SFR_IO8(0x10)
+#define DDRD    _SFR_IO8(0x11)
+#define PORTD   _SFR_IO8(0x12)
+#define PINC    _SFR_IO8(0x13)
+#define DDRC    _SFR_IO8(0x14)
+#define PORTC   _SFR_IO8(0x15)
+#define PINB    _SFR_IO8(0x16)
+#define DDRB    _SFR_IO8(0x17)
+#define PORTB   _SFR_IO8(0x18)
+#define EECR    _SFR_IO8(0x1C)
+#define EEDR    _SFR_IO8(0x1D)
+#define EEARL   _SFR_IO8(0x1E)
+#define EEARH   _SFR_IO8(0x1F)
+#define UBRRH   _SFR_IO8(0x20)
+#define UCSRC   _SFR_IO8(0x20)
+#define WDTCR   _SFR_IO8(0x21)
+#define ASSR    _SFR_IO8(0x22)
+#define OCR2    _SFR_IO8(0x23)
+#define TCNT2   _SFR_IO8(0x24)
+#define TCCR2   _SFR_IO8(0x25)
+#define ICR1    _SFR_IO16(0x26)
+#define OCR1B   _SFR_IO16(0x28)
+#define OCR1A   _SFR_IO16(0x2A)
+#define TCNT1   _SFR_IO16(0x2C)
+#define TCCR1B  _SFR_IO8(0x2E)
+#define TCCR1A  _SFR_IO8(0x2F)
+#define SFIOR   _SFR_IO8(0x30)
+#define OSCCAL  _SFR_IO8(0x31)
+#define TCNT0   _SFR_IO8(0x32)
+#define TCCR0   _SFR_IO8(0x33)
+#define MCUCSR  _SFR_IO8(0x34)
+#define MCUCR   _SFR_IO8(0x35)
+#define TIFR    _SFR_IO8(0x38)
+#define TIMSK   _SFR_IO8(0x39)
+#define GIFR    _SFR_IO8(0x3A)
+#define GICR    _SFR_IO8(0x3B)
+#define SREG    _SFR_IO8(0x3F)
+
+// SREG
+#define SREG_I  7
+
+// SPI
+#define SPIF    7
+#define SPE     6
+#define MSTR    4
+#define CPHA    2
+#define SPR1    1
+#define SPR0    0
+
+// USART
+#define RXC     7
+#define TXC     6
+#define UDRE    5
+#define FE      4
+#define DOR     3
+#define RXCIE   7
+#define TXCIE   6
+#define UDRIE   5
+#define RXEN    4
+#define TXEN    3
+#define URSEL   7
+#define USBS    3
+#define UCSZ0   1
+
+// ADC
+#define ADEN    7
+#define ADSC    6
+#define ADFR    5
+#define ADIF    4
+#define ADIE    3
+#define ADPS2   2
+#define ADPS1   1
+#define ADPS0   0
+
+// timers
+#define TOIE0   0
+#define TOV0    0
+#define TOIE2   6
+#define TOV2    6
+#define CS00    0
+#define CS01    1
+#define CS02    2
+#define CS10    0
+#define CS11    1
+#define CS12    2
+#define CS20    0
+#define CS21    1
+#define CS22    2
+#define COM1A1  7
+#define COM1A0  6
+#define WGM11   1
+#define WGM10   0
+#define WGM13   4
+#define WGM12   3
+
+// external interrupts
+#define INT0    6
+#define INT1    7
+#define INTF0   6
+#define ISC00   0
+#define ISC01   1
+
+// MCUCR sleep, MCUCSR reset flags
+#define SE      7
+#define WDRF    3
+#define BORF    2
+#define EXTRF   1
+#define PORF    0
+
+#endif
@@ -0,0 +1,17 @@
+///\file host/avr/pgmspace.h
+///\brief Program memory is ordinary memory in the HOST build
+#ifndef _HOST_AVR_PGMSPACE_H_
+#define _HOST_AVR_PGMSPACE_H_
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P               const char *
+#define PSTR(s)             (s)
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define pgm_read_word(p)    (*(const uint16_t *)(p))
+#define strlen_P            strlen
+
+#endif
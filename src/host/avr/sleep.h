@@ -0,0 +1,20 @@
+///\file host/avr/sleep.h
+///\brief Sleeping advances simulated time in the HOST build
+#ifndef _HOST_AVR_SLEEP_H_
+#define _HOST_AVR_SLEEP_H_
+
+#include <inttypes.h>
+
+#define SLEEP_MODE_IDLE     0
+#define SLEEP_MODE_ADC      1
+#define SLEEP_MODE_PWR_DOWN 2
+
+extern uint8_t hal_sleep_mode;
+void hal_sleep();
+
+#define set_sleep_mode(m)   (hal_sleep_mode = (m))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()         hal_sleep()
+
+#endif
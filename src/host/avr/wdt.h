@@ -0,0 +1,24 @@
+///\file host/avr/wdt.h
+///\brief Watchdog for the HOST build, a timeout ends the simulation
+#ifndef _HOST_AVR_WDT_H_
+#define _HOST_AVR_WDT_H_
+
+#include <inttypes.h>
+
+#define WDTO_15MS   0
+#define WDTO_30MS   1
+#define WDTO_60MS   2
+#define WDTO_120MS  3
+#define WDTO_250MS  4
+#define WDTO_500MS  5
+#define WDTO_1S     6
+#define WDTO_2S     7
+
+void hal_wdt_enable(uint8_t timeout);
+void hal_wdt_reset();
+
+#define wdt_enable(t)   hal_wdt_enable(t)
+#define wdt_disable()   hal_wdt_enable(0xff)
+#define wdt_reset()     hal_wdt_reset()
+
+#endif
@@ -0,0 +1,370 @@
+///\file hal_host.c
+///
+///\brief Native host build: simulated ATmega8 peripherals and a fake DS3234
+///
+/// The firmware is compiled with gcc against the register file in
+/// host/avr/io.h and linked with this file. Time only advances when the
+/// firmware sleeps or delays. It runs in microsecond steps:
+///
+/// - Timer0 and Timer2 count at F_CPU/8 and Timer0 overflows call
+///   TIMER0_OVF_vect
+/// - Timer1 PWM on OCR1A drives a first-order model of the HV rail, which
+///   the ADC converts every 104us and hands to ADC_vect
+/// - the DS3234 keeps time from the host clock, drives INT0 with its 1Hz
+///   square wave or once-a-second alarm and talks to rtc.c through the
+///   SPI calls in hal.h
+/// - the USART sends at 19200 bit/s to stdout and receives from stdin,
+///   so stdout carries the same byte stream as the real serial line
+/// - what the tubes show is printed on stderr whenever it changes
+///
+/// Environment: SATASHNIK_SECONDS sets simulated run time, default 10.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "util.h"
+#include "rtc.h"
+#include "hal.h"
+
+/// 13 ADC clocks at the ADPS prescaler, F_CPU/64 = 104us, F_CPU/128 = 208us
+#define US_PER_ADC          ((13 << (ADCSRA & 7)) / (F_CPU / 1000000L))
+#define US_PER_UART_BYTE    521     //!< 10 bits at 19200 bit/s
+#define US_PER_SECOND       1000000
+#define US_PER_DISPLAY      100000  //!< display sampling period
+
+volatile uint8_t hal_io[64] __attribute__ ((aligned (2)));
+uint8_t hal_sleep_mode;
+
+void TIMER0_OVF_vect(void);
+void ADC_vect(void);
+void USART_RXC_vect(void);
+void USART_UDRE_vect(void);
+void INT0_vect(void);
+
+static uint64_t now_us;             //!< simulated time
+static uint64_t end_us;
+
+static double hv;                   //!< HV rail in ADC units
+static uint16_t adc_left;           //!< us until conversion is complete, 0 = idle
+
+static uint16_t uart_left;          //!< us until uart_tx is sent
+static uint8_t uart_tx;             //!< byte being sent, UDR reads give the received byte
+
+static uint64_t wdt_deadline;       //!< 0 = watchdog off
+
+static uint8_t rtc[RTC_NREGS];      //!< DS3234 registers
+static uint8_t rtc_addr;
+static uint8_t rtc_write;
+static uint8_t rtc_active;          //!< transaction in progress
+static uint32_t rtc_us;             //!< us into the current second
+
+static uint8_t shown[4];            //!< cathode codes last seen on each anode
+static uint16_t dot_on;             //!< Timer0 ticks with the dot on since last print
+static uint16_t dot_ticks;
+static char display[8];             //!< last printed display
+
+////
+//// DS3234
+////
+
+static uint8_t bcd(uint8_t x) {
+    return ((x / 10) << 4) | (x % 10);
+}
+
+static uint8_t bcd_inc(uint8_t *reg, uint8_t wrap, uint8_t first) {
+    uint8_t x = frombcd(*reg) + 1;
+
+    if (x >= wrap) {
+        *reg = bcd(first);
+        return 1;
+    }
+    *reg = bcd(x);
+    return 0;
+}
+
+static void rtc_second() {
+    if (bcd_inc(&rtc[0], 60, 0) && bcd_inc(&rtc[1], 60, 0) && bcd_inc(&rtc[2], 24, 0)) {
+        bcd_inc(&rtc[3], 7, 0);
+        if (bcd_inc(&rtc[4], frombcd(days_in_month_bcd(rtc[6], rtc[5])) + 1, 1) &&
+            bcd_inc(&rtc[5], 13, 1)) {
+            bcd_inc(&rtc[6], 100, 0);
+        }
+    }
+
+    if (rtc[RTC_CONTROL] & _BV(RTC_INTCN)) {
+        // alarm 1 with all mask bits set fires every second
+        rtc[RTC_STATUS] |= _BV(0);
+    } else if (GICR & _BV(INT0)) {
+        // 1Hz square wave falls at the start of the second
+        GIFR |= _BV(INTF0);
+    }
+}
+
+/// INT# is low while an enabled alarm flag is set
+static uint8_t rtc_int_low() {
+    return (rtc[RTC_CONTROL] & _BV(RTC_INTCN)) && (rtc[RTC_CONTROL] & rtc[RTC_STATUS] & 3);
+}
+
+uint8_t hal_spi_xfer(uint8_t b) {
+    uint8_t reply = 0;
+
+    if (PORTB & _BV(6)) {
+        // not selected
+    } else if (!rtc_active) {
+        rtc_active = 1;
+        rtc_addr = b & 0177;
+        rtc_write = b & 0200;
+    } else {
+        if (rtc_addr < RTC_NREGS) {
+            if (!rtc_write) {
+                reply = rtc[rtc_addr];
+            } else if (rtc_addr == RTC_STATUS) {
+                // alarm flags can only be cleared
+                rtc[rtc_addr] = (b & ~3) | (b & rtc[rtc_addr] & 3);
+            } else {
+                rtc[rtc_addr] = b;
+                if (rtc_addr == 0) {
+                    // writing seconds restarts the countdown chain
+                    rtc_us = 0;
+                }
+            }
+        }
+        rtc_addr++;
+    }
+
+    SPDR = reply;
+    SPSR |= _BV(SPIF);
+    return reply;
+}
+
+void hal_spi_end() {
+    rtc_active = 0;
+}
+
+////
+//// Display
+////
+
+static char decode(uint8_t raw) {
+    uint8_t d;
+
+    for (d = 0; d < 10; d++) {
+        if (RAWNIBBLE(d) == raw) {
+            return '0' + d;
+        }
+    }
+    return ' ';
+}
+
+/// Remember the cathode code on the lit anode
+static void display_sample() {
+    static const uint8_t anodes[4] = { 0, 0200, 0100, 040 };
+    uint8_t n;
+
+    for (n = 0; n < 4; n++) {
+        if (n == SA1 ? (PORTSA1 & _BV(0)) : (PORTSA234 & anodes[n])) {
+            shown[n] = PORTDIGIT & 017;
+        }
+    }
+    
+    dot_ticks++;
+    if (PORTDOT & _BV(DOT)) {
+        dot_on++;
+    }
+}
+
+static void display_print() {
+    char s[8];
+
+    s[0] = decode(shown[3]);
+    s[1] = decode(shown[2]);
+    // 1/8 duty is a lit dot, the keep-alive pulses are much shorter
+    s[2] = dot_on > dot_ticks / 32 ? '.' : ' ';
+    dot_on = dot_ticks = 0;
+    s[3] = decode(shown[1]);
+    s[4] = decode(shown[0]);
+    s[5] = 0;
+    memset(shown, 017, sizeof(shown));
+
+    if (strcmp(s, display) != 0) {
+        strcpy(display, s);
+        fprintf(stderr, "%8.3f [%s]\n", now_us / 1e6, s);
+    }
+}
+
+////
+//// Simulation
+////
+
+/// Call an interrupt handler the way the AVR does: with interrupts off
+static uint8_t interrupt(void (*vector)(void)) {
+    if (!(SREG & _BV(SREG_I))) {
+        return 0;
+    }
+    cli();
+    vector();
+    sei();
+    return 1;
+}
+
+/// Advance simulated time by 1us.
+/// \return 1 if an interrupt was taken
+static uint8_t hal_tick() {
+    uint8_t taken = 0;
+    double duty;
+    uint8_t c;
+
+    now_us++;
+    if (now_us >= end_us) {
+        fprintf(stderr, "%8.3f end of simulation\n", now_us / 1e6);
+        exit(0);
+    }
+    if (wdt_deadline != 0 && now_us > wdt_deadline) {
+        fprintf(stderr, "%8.3f watchdog reset\n", now_us / 1e6);
+        exit(2);
+    }
+
+    // Timer0 and Timer2 at F_CPU/8, one count per us
+    if (TCCR2 & 7) {
+        TCNT2++;
+    }
+    if (TCCR0 & 7) {
+        if (++TCNT0 == 0) {
+            TIFR |= _BV(TOV0);
+        }
+    }
+    if ((TIFR & _BV(TOV0)) && (TIMSK & _BV(TOIE0)) && (SREG & _BV(SREG_I))) {
+        TIFR &= ~_BV(TOV0);
+        taken |= interrupt(TIMER0_OVF_vect);
+        display_sample();
+    }
+
+    // HV rail: pump charges towards 700 units, load discharges
+    duty = (TCCR1B & 7) && ICR1 != 0 ? (double) OCR1A / ICR1 : 0;
+    hv += duty * (700 - hv) / 5000 - hv / 20000;
+
+    // ADC
+    if (ADCSRA & _BV(ADEN)) {
+        if (adc_left == 0 && (ADCSRA & _BV(ADSC))) {
+            adc_left = US_PER_ADC;
+        }
+        if (adc_left != 0 && --adc_left == 0) {
+            ADC = (uint16_t) hv + rand() % 3 - 1;
+            ADCSRA |= _BV(ADIF);
+            if (ADCSRA & _BV(ADFR)) {
+                adc_left = US_PER_ADC;
+            } else {
+                ADCSRA &= ~_BV(ADSC);
+            }
+        }
+        if ((ADCSRA & _BV(ADIF)) && (ADCSRA & _BV(ADIE)) && (SREG & _BV(SREG_I))) {
+            ADCSRA &= ~_BV(ADIF);
+            taken |= interrupt(ADC_vect);
+        }
+    } else {
+        adc_left = 0;
+    }
+
+    // USART
+    if (uart_left != 0 && --uart_left == 0) {
+        putchar(uart_tx);
+        fflush(stdout);
+        UCSRA |= _BV(UDRE);
+    }
+    if (uart_left == 0 && (UCSRB & _BV(TXEN))) {
+        UCSRA |= _BV(UDRE);
+        if ((UCSRB & _BV(UDRIE)) && interrupt(USART_UDRE_vect)) {
+            uart_tx = UDR;
+            UCSRA &= ~_BV(UDRE);
+            uart_left = US_PER_UART_BYTE;
+            taken = 1;
+        }
+    }
+    if (now_us % US_PER_UART_BYTE == 0 && (UCSRB & _BV(RXEN)) && read(0, &c, 1) == 1) {
+        UDR = (uint8_t) c;
+        UCSRA |= _BV(RXC);
+        if (UCSRB & _BV(RXCIE)) {
+            taken |= interrupt(USART_RXC_vect);
+        }
+    }
+
+    // DS3234 and INT0
+    if (++rtc_us == US_PER_SECOND) {
+        rtc_us = 0;
+        rtc_second();
+    }
+    if (GICR & _BV(INT0)) {
+        if ((MCUCR & BV2(ISC01, ISC00)) == 0 ? rtc_int_low() : (GIFR & _BV(INTF0)) != 0) {
+            if (interrupt(INT0_vect)) {
+                GIFR &= ~_BV(INTF0);
+                taken = 1;
+            }
+        }
+    }
+
+    if (now_us % US_PER_DISPLAY == 0) {
+        display_print();
+    }
+
+    return taken;
+}
+
+/// Sleep until an interrupt is taken
+void hal_sleep() {
+    while (!hal_tick());
+}
+
+void hal_delay_us(uint32_t us) {
+    while (us--) {
+        hal_tick();
+    }
+}
+
+void hal_wdt_enable(uint8_t timeout) {
+    wdt_deadline = timeout > 7 ? 0 : now_us + (16000UL << timeout);
+    hal_io[0x21] = timeout;
+}
+
+void hal_wdt_reset() {
+    if (wdt_deadline != 0) {
+        wdt_deadline = now_us + (16000UL << hal_io[0x21]);
+    }
+}
+
+/// Power-on state, runs before the firmware's main()
+static void __attribute__ ((constructor)) hal_init() {
+    struct timespec ts;
+    struct tm *tm;
+    const char *seconds = getenv("SATASHNIK_SECONDS");
+
+    // not time(), the firmware has a global of that name
+    clock_gettime(CLOCK_REALTIME, &ts);
+    tm = localtime(&ts.tv_sec);
+
+    end_us = (uint64_t) ((seconds ? atof(seconds) : 10) * US_PER_SECOND);
+
+    PINB = PINC = PIND = 0377;      // buttons released
+    MCUCSR = _BV(PORF);
+    UCSRA = _BV(UDRE);
+
+    rtc[0] = bcd(tm->tm_sec);
+    rtc[1] = bcd(tm->tm_min);
+    rtc[2] = bcd(tm->tm_hour);
+    rtc[3] = tm->tm_wday;
+    rtc[4] = bcd(tm->tm_mday);
+    rtc[5] = bcd(tm->tm_mon + 1);
+    rtc[6] = bcd(tm->tm_year % 100);
+
+    fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+    memset(display, 0, sizeof(display));
+}
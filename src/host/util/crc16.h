@@ -0,0 +1,19 @@
+///\file host/util/crc16.h
+///\brief avr-libc CRC helpers for the HOST build
+#ifndef _HOST_UTIL_CRC16_H_
+#define _HOST_UTIL_CRC16_H_
+
+#include <inttypes.h>
+
+/// Dallas/iButton CRC8, polynomial x^8 + x^5 + x^4 + 1
+static inline uint8_t _crc_ibutton_update(uint8_t crc, uint8_t data) {
+    uint8_t i;
+
+    crc ^= data;
+    for (i = 0; i < 8; i++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0x8c : crc >> 1;
+    }
+    return crc;
+}
+
+#endif
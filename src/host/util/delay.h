@@ -0,0 +1,13 @@
+///\file host/util/delay.h
+///\brief Delays advance simulated time in the HOST build
+#ifndef _HOST_UTIL_DELAY_H_
+#define _HOST_UTIL_DELAY_H_
+
+#include <inttypes.h>
+
+void hal_delay_us(uint32_t us);
+
+#define _delay_us(us)   hal_delay_us(us)
+#define _delay_ms(ms)   hal_delay_us((uint32_t)(ms) * 1000)
+
+#endif
@@ -17,8 +17,8 @@
 #include <avr/sleep.h>
 #include <avr/pgmspace.h>
 #include <avr/wdt.h>
-#include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #include <util/delay.h>
 
@@ -29,56 +29,123 @@
 #include "buttonry.h"
 #include "modes.h"
 #include "cal.h"
+#include "settings.h"
+#include "proto.h"
+#include "profile.h"
+#include "hal.h"
+#include "sched.h"
 
 volatile uint16_t time = 0;         //!< current display value
 volatile uint16_t timef = 0;        //!< fadeto display value
 
-volatile uint8_t digitmux = 0;              //!< displayed digit, 0..3
-volatile uint16_t digitsraw = 0;            //!< raw port values
-volatile uint16_t rawfadefrom = 0177777;    //!< digitsraw fade from
-volatile uint16_t rawfadeto = 0177777;      //!< digitsraw fade to
-
-volatile uint8_t blinktick = 0;     //!< 1 when a pressed button is autorepeated
+uint8_t rawfadefrom[4] = {017,017,017,017}; //!< raw digits fade from
+uint8_t rawfadeto[4] = {017,017,017,017};   //!< raw digits fade to
+uint8_t fademask;                           //!< digits that differ in rawfadefrom and rawfadeto
+uint8_t fadelag[4];                         //!< fade steps each digit lags behind the first one
+uint8_t fadelast;                           //!< max of fadelag
+int8_t fadestep;                //!< crossfade steps left and trigger, write "-1" to start fade to timef
 
 volatile uint16_t blinkctr;     //!< blinkmode counter
-volatile uint8_t blinkduty;     //!< blinkmode duty 
 
-volatile uint8_t fadeduty, fadectr; //!< crossfade counters
-volatile int16_t fadetime;      //!< crossfade time and trigger, write "-1" to start fade to timef
+/// What TIMER0_OVF_vect outputs during one slow cycle (32 ticks)
+typedef struct _frameslot {
+    uint8_t cathode;            //!< digit code for ID1, low nibble first, high nibble from tick fade on
+    uint8_t blank;              //!< tick when the anode goes off, 0 if the digit is off
+    uint8_t dot;                //!< dot is on in ticks where bit (odd & 7) is set
+    uint8_t fade;               //!< tick when the cathode switches to the high nibble, 0 = no switch
+} FRAMESLOT;
+
+#define FRAMESLOTS 32           //!< slow cycles in a frame, frame slot n displays digit n & 3
+
+FRAMESLOT frame[2][FRAMESLOTS]; //!< display frames, rendered by display_render()
+volatile uint8_t framefront;    //!< frame being displayed, the other one is rendered into
+volatile uint8_t slowctr;       //!< slow cycle counter, frame slot is slowctr % FRAMESLOTS
+volatile uint8_t display_dirty; //!< set to force display_render() to render a new frame
 
 volatile uint8_t halfbright;    //!< keep low duty
 
 #define TIMERCOUNT  25          //<! Timer reloads with 256-TIMERCOUNT
+#define TIMER0_PRESCALE 8       //!< Timer0 clock is F_CPU/8, see timer0_init()
+
+/// Slow cycles (32 Timer0 overflows) in a second
+#define SLOWPERSEC  (F_CPU/TIMER0_PRESCALE/TIMERCOUNT/32)
+
+#define GREETING_MS 250         //!< how long the greeting is shown at boot
+
+/// Half a second in slow cycles, blinks toggle on it.
+/// Derived from F_CPU and trimmed to the RTC by blink_trim().
+uint16_t bcq2 = SLOWPERSEC/2;
+
+volatile uint16_t secslow;      //!< slow cycles since the last second
+uint16_t secmeasured;           //!< slow cycles in the last second, for telemetry
+#ifdef RTC_SQW_INT0
+volatile uint16_t secsample;    //!< slow cycles in the last second, from INT0_vect
+#endif
 
+/// Scheduler ticks (64 Timer0 overflows each) in a second
+#define LOOPSPERSEC (SLOWPERSEC/2)
 
-/// Values for blinking, calibrated to quarters of a second at startup
-uint16_t bcq1;
-uint16_t bcq2;
-uint16_t bcq3;
+#define CLOCK_PERIOD (LOOPSPERSEC/50)   //!< ticks between display value updates, 20ms
+
+/// Main loop tasks, in the order they run, \see tasks
+enum _main_task {
+    TASK_UART = 0,
+    TASK_BUTTONS,
+    TASK_TELEMETRY,
+    TASK_RTC,
+    TASK_SETTINGS,
+    TASK_CLOCK,
+    TASK_DISPLAY,
+    NTASKS
+};
+
+RTC_TIME timenow;               //!< time snapshot, updated by task_rtc()
+
+uint8_t dark_awake;             //!< SAVEDARK: seconds left before the tubes may go dark again
+
+static uint8_t override_left;   //!< seconds left to show the display_override() value
+
+/// Shorten the duty of digits, \see display_render()
+static void halfbright_set(uint8_t hb) {
+    if (hb != halfbright) {
+        halfbright = hb;
+        sched_signal(SCHED_DISPLAY);
+    }
+}
 
-void savingmode_keep(uint16_t hhmm) {
+/// Set HV setpoint and duty for current saving mode.
+/// \return 1 when the tubes should be shut off completely, see deepnight()
+uint8_t savingmode_keep(uint16_t hhmm) {
     switch (savingmode_get()) {
+        case SAVEDARK:
+#ifdef RTC_SQW_INT0
+            if (dark_awake == 0 && savingmode_dark(hhmm)) {
+                return 1;
+            }
+#endif
+            // dim like SAVENIGHT when not dark
         case SAVENIGHT:
             if (hhmm > 0x0100 && hhmm < 0x0700) {
-                voltage_set(VOLTAGE_SAVE);
-                halfbright = 2;                     // darkest
+                voltage_set(voltage_level_get(VOLTAGE_LEVEL_SAVE));
+                halfbright_set(2);                  // darkest
             } else if (hhmm < 0x0800) {
-                voltage_set(VOLTAGE_SAVE);
-                halfbright = 1;                     // dark
+                voltage_set(voltage_level_get(VOLTAGE_LEVEL_SAVE));
+                halfbright_set(1);                  // dark
             } else {
-                voltage_set(VOLTAGE_WASTE);
-                halfbright = 0;                     // normal
+                voltage_set(voltage_level_get(VOLTAGE_LEVEL_WASTE));
+                halfbright_set(0);                  // normal
             }
             break;
         case SAVE:
-            voltage_set(VOLTAGE_SAVE);
-            halfbright = 1;
+            voltage_set(voltage_level_get(VOLTAGE_LEVEL_SAVE));
+            halfbright_set(1);
             break;
         case WASTE:
-            voltage_set(VOLTAGE_WASTE);
-            halfbright = 0;
+            voltage_set(voltage_level_get(VOLTAGE_LEVEL_WASTE));
+            halfbright_set(0);
             break;
     }
+    return 0;
 }
 
 /// Init display-related DDRs.
@@ -89,72 +156,67 @@ void initdisplay() {
     DDRSA234 |= BV3(5,6,7);
 }
 
-/// Rehash bits to match the schematic
-uint8_t swapbits(uint8_t x) {
-    return ((x & 1) << 3) | (x & 2) | ((x & 4) >> 2) | ((x & 8) >> 1);
-}
-
-/// get raw digits from hh:mm
-uint16_t getrawdigits(uint8_t h1, uint8_t h2, uint8_t m1, uint8_t m2) {
-    return (swapbits(h1)<<12) | (swapbits(h2)<<8) | (swapbits(m1)<<4) | swapbits(m2);
-}
-
-/// get raw digits from a BCD value
-uint16_t getrawdigits_bcd(uint16_t time) {
-    return getrawdigits((time & 0xf000)>>12, (time & 0x0f00)>>8, (time & 0x00f0)>>4, time & 0x000f);
-}
-
-/// Output the current digit code to ID1
-uint8_t display_currentdigit(uint8_t n) {
-    uint8_t dispbit = 0x0f;
+#define RAW16(h) RAWBYTE(h+0x0),RAWBYTE(h+0x1),RAWBYTE(h+0x2),RAWBYTE(h+0x3),\
+                 RAWBYTE(h+0x4),RAWBYTE(h+0x5),RAWBYTE(h+0x6),RAWBYTE(h+0x7),\
+                 RAWBYTE(h+0x8),RAWBYTE(h+0x9),RAWBYTE(h+0xa),RAWBYTE(h+0xb),\
+                 RAWBYTE(h+0xc),RAWBYTE(h+0xd),RAWBYTE(h+0xe),RAWBYTE(h+0xf)
+
+/// Packed BCD byte to schematic-ordered cathode codes, generated from CATHODE_Bx
+static const uint8_t rawdigits[256] PROGMEM = {
+    RAW16(0x00), RAW16(0x10), RAW16(0x20), RAW16(0x30),
+    RAW16(0x40), RAW16(0x50), RAW16(0x60), RAW16(0x70),
+    RAW16(0x80), RAW16(0x90), RAW16(0xa0), RAW16(0xb0),
+    RAW16(0xc0), RAW16(0xd0), RAW16(0xe0), RAW16(0xf0),
+};
+
+/// get raw digits from a BCD value, digit 0 is the least significant
+void getrawdigits_bcd(uint16_t bcd, uint8_t *raw) {
+    uint8_t hh = pgm_read_byte(&rawdigits[bcd >> 8]);
+    uint8_t mm = pgm_read_byte(&rawdigits[bcd & 0377]);
     
-    if (n < 4) {
-        dispbit = 0x0f & (digitsraw >> (n<<2));
-        PORTDIGIT = (PORTDIGIT & ~BV4(0,1,2,3)) | dispbit;
-    } else {
-        PORTDIGIT |= 0x0f;
-    }
-    
-    return dispbit != 0x0f;
+    raw[0] = mm & 017;
+    raw[1] = mm >> 4;
+    raw[2] = hh & 017;
+    raw[3] = hh >> 4;
 }
 
-/// Shut off previous anode, wait to prevent ghosting,
-/// output new digit code to ID1 and enable new anode
-void display_selectdigit(uint8_t n) {
-    switch (n) {
-        case SA1: 
-                PORTSA234 &= ~BV3(5,6,7);
-                _delay_ms(0.01); //ghosting prevention
-                if (display_currentdigit(n)) {
-                    PORTSA1 |= _BV(0);
-                }
-                break;
-        case SA2:
-        case SA3:
-        case SA4:
-                PORTSA1 &= ~_BV(0);
-                PORTSA234 &= ~BV3(5,6,7);
-                _delay_ms(0.01); //ghosting prevention
-                if (display_currentdigit(n)) {
-                    PORTSA234 |= 0200 >> (n-1);
-                }
-                break;
-        default:
-                PORTSA234 &= ~BV3(5,6,7);
-                PORTSA1 &= ~_BV(0);
-                break;
-    }
+/// Shut off all anodes
+static inline void display_blank() {
+    PORTSA234 &= ~BV3(5,6,7);
+    PORTSA1 &= ~_BV(0);
 }
 
 /// Start fading time to given value. 
-/// Transition is performed in TIMER0_OVF_vect and takes FADETIME cycles.
+/// Transition is rendered by display_render() and takes FADETIME slow cycles.
+/// Only digits that change are faded. With fade_cascade, they start one after 
+/// another, most significant first.
 void fadeto(uint16_t t) { 
-    uint16_t raw = getrawdigits_bcd(t); // takes time
-    cli();
+    uint8_t raw[4], lag[4];
+    uint8_t mask = 0, start = 0;
+    int8_t i;
+    
+    getrawdigits_bcd(t, raw);
+    
+    for (i = 3; i >= 0; i--) {
+        lag[i] = start;
+        if (raw[i] != rawfadefrom[i]) {
+            mask |= _BV(i);
+            if (fade_get() != FADE_OFF) {
+                start += fade_cascade;
+            }
+        }
+    }
+    start = start == 0 ? 0 : start - fade_cascade;
+    
     timef = t; 
-    rawfadeto = raw;
-    fadetime = -1;
-    sei();
+    fademask = mask;
+    fadelast = start;
+    for (i = 0; i < 4; i++) {
+        rawfadeto[i] = raw[i];
+        fadelag[i] = (mask & _BV(i)) ? start - lag[i] : 0;
+    }
+    fadestep = -1;
+    sched_signal(SCHED_DISPLAY);
 }
 
 /// Return current BCD display value 
@@ -162,6 +224,21 @@ inline uint16_t get_display_value() {
     return timef;
 }
 
+/// Show t at once, without fading
+void display_show(uint16_t t) {
+    uint8_t i;
+    
+    getrawdigits_bcd(t, rawfadeto);
+    for (i = 0; i < 4; i++) {
+        rawfadefrom[i] = rawfadeto[i];
+    }
+    fademask = 0;
+    fadestep = 0;
+    time = timef = t;
+    display_dirty = 1;
+    sched_signal(SCHED_DISPLAY);
+}
+
 /// Start timer 0. Timer0 runs at 1MHz
 /// The speed is dictated by the need to keep the neon dot ionized at all times
 void timer0_init() {
@@ -170,9 +247,169 @@ void timer0_init() {
     TCCR0 = _BV(CS01);
 }
 
+/// Blink masks for digits, \see _blinkmode
+static const uint8_t blinkdigits[4] = { 0, 014, 003, 017 };
+
+/// Advance crossfade by the slow cycles elapsed since last call
+static void display_fade(uint8_t elapsed) {
+    static uint8_t fadeslow;    // slow cycles left until next fade step
+    uint8_t i;
+    
+    // fadestep == -1 indicates start of fade
+    if (fadestep == -1) {
+        if (fade_get() == FADE_OFF) {
+            fadestep = 0;
+        } else {
+            // start teh fade
+            fadestep = fade_steps + fadelast;
+            fadeslow = fade_rate;
+            return;
+        }
+    } else if (fadestep != 0) {
+        // next step on the fade curve every fade_rate slow cycles
+        while (fadestep != 0 && elapsed >= fadeslow) {
+            elapsed -= fadeslow;
+            fadeslow = fade_rate;
+            fadestep--;
+        }
+        if (fadestep != 0) {
+            fadeslow -= elapsed;
+            return;
+        }
+    } else {
+        return;
+    }
+    
+    // end fade, render the new digits once more
+    fademask = 0;
+    display_dirty = 1;
+    time = timef;
+    for (i = 0; i < 4; i++) {
+        rawfadefrom[i] = rawfadeto[i];
+    }
+}
+
+/// Compose digits, crossfade, blinking, dot and saving duty into a frame 
+/// of port values and swap it in. TIMER0_OVF_vect then only outputs the 
+/// frame. Called from the main loop, renders only when something has changed.
+void display_render() {
+    static uint8_t lastslow;
+    static uint16_t lastlook;
+    FRAMESLOT *f;
+    uint8_t elapsed, i, n, k, from, to, blinkmask, dot, blank, span, old;
+    uint8_t duty[4], dblank[4];
+    uint16_t bc, look;
+    int8_t left;
+    
+    cli();
+    elapsed = slowctr - lastslow;
+    bc = blinkctr;
+    sei();
+    lastslow += elapsed;
+    
+    display_fade(elapsed);
+    
+    // blinking (blinkmode & 0200 temporarily disables blinking)
+    blinkmask = 0;
+    if ((blinkmode_get() & 0200) == 0 && bc > bcq2) {
+        blinkmask = blinkdigits[blinkmode_get() & 3];
+    }
+    
+    // the dot is on with a short duty, keep the gas ionized when it's off
+    dot = dotmode == DOT_ON || (dotmode == DOT_BLINK && bc <= bcq2);
+    
+    // anything to render?
+    look = (blinkmask << 8) | (dot << 7) | (dotmode << 4) | halfbright;
+    if (!display_dirty && fadestep == 0 && fademask == 0 && look == lastlook) {
+        return;
+    }
+    display_dirty = 0;
+    lastlook = look;
+    
+    // shorten duty cycle for cathode-preserving modes
+    blank = halfbright == 2 ? 0x08 : halfbright == 1 ? 0x10 : FRAMESLOTS;
+    
+    // per-digit blanking and duty of the old digit, only changing digits fade
+    for (n = 0; n < 4; n++) {
+        dblank[n] = blank;
+        if ((rawfadefrom[n] == RAWNIBBLE(3) || rawfadeto[n] == RAWNIBBLE(3)) && blank > 0x18) {
+            // switch bright digits earlier
+            dblank[n] = 0x18;
+        }
+        if ((rawfadefrom[n] == 017 && rawfadeto[n] == 017) || (blinkmask & _BV(n))) {
+            dblank[n] = 0;
+        }
+        
+        duty[n] = 0;
+        if ((fademask & _BV(n)) && dblank[n] != 0) {
+            left = fadestep - fadelag[n];
+            if (left > (int8_t)fade_steps) {
+                left = fade_steps;
+            }
+            if (left > 0) {
+                // old digit ticks in the digit's 8 slots of the frame
+                duty[n] = (pgm_read_byte(&fade_curve[left]) * (dblank[n] - ANODE_BLANK_TICKS)) 
+                          / (FADEDUTY_MAX / (FRAMESLOTS / 4));
+            }
+        }
+    }
+    
+    f = frame[framefront ^ 1];
+    for (i = 0; i < FRAMESLOTS; i++, f++) {
+        n = i & 3;
+        k = i >> 2;
+        from = rawfadefrom[n];
+        to = rawfadeto[n];
+        span = dblank[n] - ANODE_BLANK_TICKS;
+        
+        // spread the old digit ticks evenly over the digit's slots,
+        // it shows from the anode going on until the fade tick
+        old = ((k + 1) * duty[n] >> 3) - (k * duty[n] >> 3);
+        
+        // code 017 lights no cathode, so a blank digit fades like any other
+        f->blank = dblank[n];
+        f->fade = 0;
+        if (old == 0) {
+            f->cathode = to;
+        } else if (old >= span) {
+            f->cathode = from;
+        } else {
+            f->cathode = from | (to << 4);
+            f->fade = ANODE_BLANK_TICKS + old;
+        }
+        
+        f->dot = dot;
+        if (dotmode == DOT_BLINK && (i & 15) == 0) {
+            f->dot = 1;
+        }
+    }
+    
+    framefront ^= 1;
+}
+
+/// Render while waiting, for use before the main loop is running
+void display_wait(uint16_t ms) {
+    while (ms--) {
+        _delay_ms(1);
+        display_render();
+    }
+}
+
+/// Anode bits on PORTSA234 for digits, SA1 is on PORTSA1
+static const uint8_t anodes234[4] = { 0, 0200, 0100, 040 };
+
+/// Dot bits for ticks
+static const uint8_t dotbits[8] = { 1, 2, 4, 010, 020, 040, 0100, 0200 };
+
 ISR(TIMER0_OVF_vect) {
-    uint16_t toDisplay = time;
+    prof_enter();
     static uint8_t odd = 0;
+    static FRAMESLOT cur;       // current frame slot
+    static uint8_t dotflash;    // dot flashes at the start of a second
+    uint8_t n;
+    
+    // TCNT0 counts up from the overflow until the reload
+    prof_latency(TCNT0);
     
     TCNT0 = 256-TIMERCOUNT;
 
@@ -181,132 +418,434 @@ ISR(TIMER0_OVF_vect) {
     // Handle the dot, which must be sustained at all times
     // High-frequency short-duty seems to be an acceptable way
     // of keeping the gas ionized, yet practically invisible
-    if ((odd & 7) < (( (dotmode == DOT_OFF || blinkctr>bcq2) && !(dotmode == DOT_ON)) ? 0:1) 
-        || ((dotmode == DOT_BLINK) && ((blinkctr <= 4) || ((odd & 0x7f) == 0)))) {
+    if ((cur.dot & dotbits[odd & 7]) || dotflash) {
         PORTDOT |= _BV(DOT);
     } else {
         PORTDOT &= ~_BV(DOT);
     }
     
-    // Signal the main loop to continue rolling
+#ifdef ADC_QUIET_SYNC
+    // sample HV feedback halfway between anode switching slots
+    if ((odd & 7) == 4) {
+        adc_quiet_start();
+    }
+#endif
+    
+    // Main loop scheduler tick
     if ((odd & 0x3f) == 0) {
-        blinktick |= _BV(2);
+        sched_tick();
     }
     
-    // A "slow" cycle every 32 fast cycles, display business
+    // A "slow" cycle every 32 fast cycles: shut off the anodes, 
+    // let the ghosts die out and then select the next digit
     if ((odd & 0x1f) == 0) {
+        display_blank();
+        
+        slowctr++;
+        secslow++;
+        cur = frame[framefront][slowctr & (FRAMESLOTS-1)];
+        
         // keep blinkctr for things that happen on 1/4ths of a second
         blinkctr++;
         if (blinkctr > (bcq2<<1)) {
             blinkctr = 0;
         }
+        dotflash = dotmode == DOT_BLINK && blinkctr <= 4;
         
-        // signal the main loop to autorepeat buttons when needed
-        if (blinkmode_get() != BLINK_NONE) {
-            if (blinkctr == bcq1 || blinkctr == bcq2 || blinkctr == bcq3 || blinkctr == 1) {
-                blinktick |= _BV(1);
-            }
+        if ((slowctr & (BUTTON_SAMPLE-1)) == 0) {
+            buttons_sample();
         }
-        
-        // fadetime == -1 indicates start of fade
-        if (fadetime == -1) {
-            if (fade_get() == FADE_OFF) {
-                fadeduty = 1;
-                fadetime = 1;
+    } else if ((odd & 0x1f) == ANODE_BLANK_TICKS) {
+        PORTDIGIT = (PORTDIGIT & ~BV4(0,1,2,3)) | (cur.cathode & 017);
+        if (cur.blank) {
+            n = slowctr & 3;
+            if (n == SA1) {
+                PORTSA1 |= _BV(0);
             } else {
-                // start teh fade
-                fadetime = fadetime_full;
-                fadeduty = 4;
-                fadectr = 0;
+                PORTSA234 |= anodes234[n];
             }
         }
-        
-        if (fadetime != 0) {
-            fadetime--;
+    } else if ((odd & 0x1f) == cur.fade) {
+        // crossfade: the new digit for the rest of the slot
+        PORTDIGIT = (PORTDIGIT & ~BV4(0,1,2,3)) | (cur.cathode >> 4);
+    } else if ((odd & 0x1f) == cur.blank) {
+        display_blank();
+    }
     
-            if (fadetime % fadetime_quart == 0) {
-                fadeduty--;
-            }
-            
-            if (fadetime == 0) {
-                fadectr = 0;
-                time = timef; // end fade
-                rawfadefrom = rawfadeto;
-            }
-        } 
+    prof_exit(PROF_TIMER0);
+}
+
+#ifdef RTC_SQW_INT0
+/// 1Hz from DS3234: the second has just changed. 
+/// Lock blinking to it and let the main loop read the new time.
+ISR(INT0_vect) {
+    if ((MCUCR & BV2(ISC01,ISC00)) == 0) {
+        // deep night wakeup: INT# is low until the alarm is acknowledged
+        GICR &= ~_BV(INT0);
+        return;
+    }
+    
+    sched_signal_isr(SCHED_RTC);
+    secsample = secslow;
+    secslow = 0;
+    if (!is_setting()) {
+        blinkctr = 0;
+        sched_signal_isr(SCHED_DISPLAY);    // the blink restarts, see task_display()
+    }
+}
+
+/// Deep night: tubes, HV and multiplexing are off, the MCU is powered down 
+/// and only wakes up once a second on DS3234 alarm to check the buttons and time.
+/// Returns with HV and display restarted when a button is pressed 
+/// or the dark window is over. 
+/// \param now current time snapshot, kept updated
+void deepnight(RTC_TIME *now) {
+    pump_nomoar();
+    
+    TIMSK &= ~_BV(TOIE0);
+    TCCR0 = 0;
+    display_blank();
+    PORTDOT &= ~_BV(DOT);
+    
+    rtc_int_alarm();
+    wdt_enable(WDTO_2S);
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    
+    do {
+        cli();
+        GICR |= _BV(INT0);
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
         
-        if ((fadectr>>3) < fadeduty) {
-            toDisplay = rawfadefrom;
-        } else {
-            toDisplay = rawfadeto;
-        }
-        fadectr = (fadectr + 1) & 037;
+        wdt_reset();
+        rtc_alarm_ack();
+        rtc_read(now);
+        update_daylight(now);       // transitions fall in the dark window
+    } while (!buttons_held() && savingmode_dark(rtc_hhmm(now)));
     
-        // blinking (blinkmode & 0200 temporarily disables blinking)
-        if (blinkmode_get() != BLINK_NONE && (blinkmode_get() & 0200) == 0 && blinkctr > bcq2) {
-            switch (blinkmode_get()) {
-                case BLINK_HH:
-                    toDisplay |= 0xff00;
-                    break;
-                case BLINK_MM:
-                    toDisplay |= 0x00ff;
-                    break;
-                case BLINK_ALL:
-                    toDisplay |= 0xffff;
-                    break;
-                default:
-                    break;
-            }
-        }
+    if (savingmode_dark(rtc_hhmm(now))) {
+        dark_awake = DARK_WAKE;
+    }
+    
+    rtc_int_sqw();
+    wdt_enable(WDTO_250MS);
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    
+    // soft restart: HV ramps up while blank digits fade into time
+    display_show(0xffff);
+    voltage_start();
+    timer0_init();
+}
+#endif
+
+/// Trim blink half-second to the length of a second measured in slow cycles.
+/// The internal RC oscillator is only so accurate, the RTC is.
+void blink_trim(uint16_t measured) {
+    static uint16_t persec = SLOWPERSEC << 2;  // average slow cycles per second x 4
+    
+    secmeasured = measured;
     
-        digitsraw = toDisplay;
+    // partial seconds after boot, setup or deep night are no good
+    if (measured < SLOWPERSEC - SLOWPERSEC/8 || measured > SLOWPERSEC + SLOWPERSEC/8) {
+        return;
     }
     
-    // every other "slow" cycle, select the next digit...
-    if ((odd & 0x1f) == 0) {
-        display_selectdigit(digitmux);
-        digitmux = (digitmux + 1) & 3;
-    } else {
-        // switch bright digits earlier
-        if ((odd & 0x1f) == 0x18) {
-            switch (PORTDIGIT & 017) {
-                case 0x0a: // "3"
-                    display_selectdigit(0377);
-                    break;
-            }
+    persec += measured - (persec >> 2);
+    
+    cli();
+    bcq2 = persec >> 3;
+    sei();
+}
+
+/// State that survives watchdog and brown-out resets
+typedef struct _warmstate {
+    uint16_t time;          //!< last display value
+    uint16_t levels[NVOLTAGELEVELS]; //!< voltage setpoints, \see _voltage_level
+    uint8_t mode;           //!< display mode, \see _displaymode
+    uint8_t savingmode;     //!< \see _savinmode
+    uint8_t dst_year;       //!< \see dst_applied()
+    uint8_t dst_done;
+    uint8_t check;          //!< checksum of the above, \see warm_check()
+} WARMSTATE;
+
+/// Not cleared by startup code, checked by warm_restore()
+WARMSTATE warm __attribute__ ((section (".noinit")));
+
+static uint8_t warm_check() {
+    uint8_t *p = (uint8_t *) &warm;
+    uint8_t i, sum = 0x5a;
+    
+    for (i = 0; i < offsetof(WARMSTATE, check); i++) {
+        sum = ((sum << 1) | (sum >> 7)) ^ *p++;
+    }
+    
+    return sum;
+}
+
+/// Remember current state for warm_restore()
+void warm_save() {
+    uint8_t i, year, done, changed;
+    
+    done = dst_applied(&year);
+    changed = warm.time != timef || warm.mode != mode_get() || warm.savingmode != savingmode_get()
+              || warm.dst_year != year || warm.dst_done != done;
+    for (i = 0; i < NVOLTAGELEVELS; i++) {
+        if (warm.levels[i] != voltage_level_get(i)) {
+            warm.levels[i] = voltage_level_get(i);
+            changed = 1;
         }
-        // shorten duty cycle for cathode-preserving modes
-        if (halfbright == 2 && (odd & 0x1f) == 0x8) {
-            display_selectdigit(0377);
+    }
+    if (!changed) {
+        return;
+    }
+    
+    warm.time = timef;
+    warm.mode = mode_get();
+    warm.savingmode = savingmode_get();
+    warm.dst_year = year;
+    warm.dst_done = done;
+    warm.check = warm_check();
+}
+
+/// Restore state saved before a watchdog or brown-out reset.
+/// \return 1 if restored, 0 for a cold start
+uint8_t warm_restore(uint8_t resetflags) {
+    uint8_t i;
+    
+    if ((resetflags & BV2(WDRF, BORF)) == 0 || warm.check != warm_check()) {
+        return 0;
+    }
+    
+    mode_set(warm.mode);
+    savingmode_set(warm.savingmode);
+    for (i = 0; i < NVOLTAGELEVELS; i++) {
+        voltage_level_set(i, warm.levels[i]);
+    }
+    dst_restore(warm.dst_year, warm.dst_done);
+    
+    return 1;
+}
+
+/// Show value instead of time for given number of seconds, 0 to release.
+/// task_rtc() counts the seconds down, the first one may be short.
+void display_override(uint16_t value, uint8_t seconds) {
+    override_left = seconds;
+    if (seconds != 0) {
+        fadeto(value);
+    }
+}
+
+/// Task: protocol frames and console commands
+void task_uart() {
+    static uint8_t uart_enabled = 0;
+    uint8_t byte;
+    VOLTAGE_STATS vstats;
+    
+    // handle protocol frames and keyboard commands
+    while (uart_available()) {
+        byte = uart_getc();
+        if (proto_rx(byte)) {
+            continue;
         }
-        if (halfbright == 1 && (odd & 0x1f) == 0x10) {
-            display_selectdigit(0377);
+        switch (uart_enabled) {
+            case 0: if (byte == 'z') 
+                        uart_enabled = 1;
+                    else
+                        uart_enabled = 0;
+                    break;
+            case 1: if (byte == 'c') 
+                        uart_enabled = 2;
+                    else
+                        uart_enabled = 0;
+                    break;
+            case 2:
+                    switch (byte) { 
+                    case '`':   pump_nomoar();
+                                break;
+                    case '.':   break;
+                    case '=':   // die
+                                for(;;);
+                                break;
+                    case 'q':   voltage_set(voltage_setpoint_get()-1);
+                                break;
+                    case 'w':   voltage_set(voltage_setpoint_get()+1);
+                                break;
+                    case 'r':   voltage_regulator_set(voltage_regulator_get() == REG_PI ? REG_BANGBANG : REG_PI);
+                                break;
+                    case 'p':   voltage_pi_set(voltage_kp_get()-1, voltage_ki_get());
+                                break;
+                    case 'P':   voltage_pi_set(voltage_kp_get()+1, voltage_ki_get());
+                                break;
+                    case 'i':   voltage_pi_set(voltage_kp_get(), voltage_ki_get()-1);
+                                break;
+                    case 'I':   voltage_pi_set(voltage_kp_get(), voltage_ki_get()+1);
+                                break;
+                    case 'm':   voltage_stats_get(&vstats);
+                                uart_printf_P(PSTR("REG=%d KP=%d KI=%d settle=%u overshoot=%u ripple=%u\n"), 
+                                    voltage_regulator_get(), voltage_kp_get(), voltage_ki_get(),
+                                    vstats.settle, vstats.overshoot, vstats.ripple);
+                                break;
+#ifdef PROFILE
+                    case 'f':   prof_print();
+                                break;
+                    case 'F':   prof_init();
+                                break;
+                    case 'g':   sched_print();
+                                break;
+#endif
+                    case 't':   uart_printf_P(PSTR("TX dropped=%u peak=%d RX overruns=%u framing=%u\n"), 
+                                    uart_tx_dropped(), uart_tx_peak(), uart_rx_overruns(), uart_rx_frame_errors());
+                                break;
+                    default:
+                                break;
+                    }
+        
+                    if (byte >= '0' && byte <= '9') {
+                        byte = byte - '0';
+                        fadeto((byte<<12)+(byte<<8)+(byte<<4)+byte);
+                        sched_defer(TASK_CLOCK, 255);
+                    }
+                    
+                    uart_printf_P(PSTR("OCR1A=%d ICR1=%d S=%d V=%d, Time=%04x\n"), OCR1A, ICR1, voltage_setpoint_get(), voltage_get(), time);
+                    
+                    // one command per pass, the text may have waited for the TX buffer
+                    if (uart_available()) {
+                        sched_signal(SCHED_UART);
+                    }
+                    return;
         }
     }
 }
 
-/// Calibrate blink counters to quarters of second
-void calibrate_blinking() {
-    bcq1 = bcq2 = bcq3 = 65535;
-    for(bcq1 = rtc_gettime(1); bcq1 == rtc_gettime(1););
-    blinkctr = 0; 
-    for(bcq1 = rtc_gettime(1); bcq1 == rtc_gettime(1););
-    cli();
-    bcq1 = blinkctr/4;
-    bcq2 = 2*blinkctr/4;
-    bcq3 = 3*blinkctr/4;
+/// Task: read the RTC when the second changes, apply DST, trim blinking and save settings
+void task_rtc() {
+    uint16_t measured;
+#ifdef RTC_SQW_INT0
+    // runs on SCHED_RTC, see INT0_vect
+    rtc_read(&timenow);
+    update_daylight(&timenow);
+    cli(); 
+    measured = secsample; 
     sei();
+    blink_trim(measured);
+    settings_tick();
+    if (dark_awake != 0) {
+        dark_awake--;
+    }
+    if (override_left != 0) {
+        override_left--;
+    }
+#else
+    static uint16_t mmss1;
+    uint16_t mmss;
+    
+    rtc_read(&timenow);
+    
+    mmss = rtc_mmss(&timenow);
+    if (!is_setting() && mmss != mmss1) {
+        mmss1 = mmss;
+        cli(); 
+        blinkctr = 0; 
+        measured = secslow;
+        secslow = 0;
+        sei();
+        sched_signal(SCHED_DISPLAY);
+        blink_trim(measured);
+        settings_tick();
+        if (override_left != 0) {
+            override_left--;
+        }
+    }
+    
+    update_daylight(&timenow);
+#endif
+}
+
+/// Task: keep the saving schedule and fade to the value of the display mode.
+/// Idle while a display_override() value is shown, the console digits 
+/// hold it off with sched_defer(). Also remembers the display for glitch recovery.
+void task_clock() {
+    uint16_t rtime = rtc_hhmm(&timenow);
+    
+    warm_save();
+    
+    if (override_left != 0) {
+        return;
+    }
+    
+    if (savingmode_keep(rtime) && !is_setting()) {
+#ifdef RTC_SQW_INT0
+        deepnight(&timenow);
+        rtime = rtc_hhmm(&timenow);
+#endif
+    }
+    
+    switch (mode_get()) {
+        case HHMM:
+            break;
+        case MMSS:
+            rtime = rtc_mmss(&timenow);
+            break;
+        case VOLTAGE:
+            rtime = voltage_getbcd();
+            break;
+    }
+    
+    if (!is_setting() && rtime != time && rtime != timef) {
+        fadeto(rtime);
+    }     
+}
+
+/// Task: render the display. Runs on SCHED_DISPLAY when something new is 
+/// to be shown, otherwise at the next fade step or blink edge.
+void task_display() {
+    uint16_t bc, slow = SCHED_MAXDELAY;
+    
+    display_render();
+    
+    if (dotmode == DOT_BLINK || (blinkmode_get() & 3) != 0) {
+        // slow cycles to the next half of the blink period
+        cli();
+        bc = blinkctr;
+        sei();
+        slow = (bc <= bcq2 ? bcq2 : bcq2 << 1) + 1 - bc;
+    }
+    if (fadestep != 0 && fade_rate < slow) {
+        slow = fade_rate;
+    }
+    sched_defer(TASK_DISPLAY, (slow + 1) >> 1);
 }
 
+/// Task: telemetry frames, SCHED_PROTO when the period is changed
+void task_telemetry() {
+    sched_defer(TASK_TELEMETRY, proto_tick());
+}
+
+/// The main loop, \see _main_task
+static TASK tasks[NTASKS] = {
+    { task_uart, 0, SCHED_UART },
+    { buttonry_tick, BUTTON_SAMPLE/2, 0 },      // as often as buttons are sampled
+    { task_telemetry, SCHED_MAXDELAY, SCHED_PROTO },
+#ifdef RTC_SQW_INT0
+    { task_rtc, 0, SCHED_RTC },
+#else
+    { task_rtc, 1, 0 },
+#endif
+    { settings_poll, CLOCK_PERIOD, 0 },         // an EEPROM byte write takes 8.5ms
+    { task_clock, CLOCK_PERIOD, 0 },
+    { task_display, SCHED_MAXDELAY, SCHED_DISPLAY },
+};
+
 /// Program main
 int main() {
-    uint8_t i;
     uint16_t rtime;
-    uint8_t byte;
-    volatile uint16_t skip = 0;
-    uint8_t uart_enabled = 0;
-    volatile uint16_t mmss, mmss1;
+    uint8_t resetflags;
 
+    resetflags = MCUCSR;
+    MCUCSR = 0;
+    
     OSCCAL = 0xA6;
 
     pump_nomoar();
@@ -314,12 +853,12 @@ int main() {
     usart_init(F_CPU/16/19200-1);
     
     //for(OSCCAL=0;;) {
-    //printf_P(PSTR("OSCCAL=%x  \n"), OSCCAL);
+    //uart_printf_P(PSTR("OSCCAL=%x  \n"), OSCCAL);
     //OSCCAL++;
     //}
 
     
-    printf_P(PSTR("\033[2J\033[HB%s WHAT DO YOU MEAN? %02x\n"), BUILDNUM, MCUCSR);
+    uart_printf_P(PSTR("\033[2J\033[HB%s WHAT DO YOU MEAN? %02x\n"), BUILDNUM, resetflags);
 
     sei();
 
@@ -328,116 +867,39 @@ int main() {
     dotmode_set(DOT_OFF);
     rtc_init();
     buttons_init();
-
-    // display greeting
-    fade_set(FADE_SLOW);
-    rtime = time = timef = 0xffff;   
-    timer0_init();
-    fadeto(0x1838);
-
-    // calibrate blink quarters and fadeout
-    calibrate_blinking();
-    fade_set(FADE_SLOW);    
-    fadeto(0xffff);
-    _delay_ms(500);
-    
-    dotmode_set(DOT_BLINK);
+    settings_restore();
+    prof_init();
+
+    if (warm_restore(resetflags)) {
+        // glitch recovery: straight back to what was on display
+        rtime = warm.time;
+        display_show(rtime);
+        timer0_init();
+    } else {
+        // display greeting
+        fade_set(FADE_SLOW);
+        rtime = time = timef = 0xffff;   
+        timer0_init();
+        fadeto(0x1838);
+
+        // blink quarters are known at compile time, no need to wait for the RTC
+        display_wait(GREETING_MS);
+        
+        // back to the fade and dot of the mode settings_restore() picked
+        mode_set(mode_get());
+    }
+    set_voltage_dot();
     
     wdt_enable(WDTO_250MS);
     
     set_sleep_mode(SLEEP_MODE_IDLE);
     
-    for(i = 0;;i++) {
-        wdt_reset();
-        
-        // handle keyboard commands
-        if (uart_available()) {
-            byte = uart_getchar();
-            switch (uart_enabled) {
-                case 0: if (byte == 'z') 
-                            uart_enabled = 1;
-                        else
-                            uart_enabled = 0;
-                        break;
-                case 1: if (byte == 'c') 
-                            uart_enabled = 2;
-                        else
-                            uart_enabled = 0;
-                        break;
-                case 2:
-                        switch (byte) { 
-                        case '`':   pump_nomoar();
-                                    break;
-                        case '.':   break;
-                        case '=':   // die
-                                    for(;;);
-                                    break;
-                        case 'q':   voltage_set(voltage_setpoint_get()-1);
-                                    break;
-                        case 'w':   voltage_set(voltage_setpoint_get()+1);
-                                    break;
-                        default:
-                                    break;
-                        }
-            
-                        if (byte >= '0' && byte <= '9') {
-                            byte = byte - '0';
-                            fadeto((byte<<12)+(byte<<8)+(byte<<4)+byte);
-                            skip = 255;
-                        }
-                        
-                        printf_P(PSTR("OCR1A=%d ICR1=%d S=%d V=%d, Time=%04x\n"), OCR1A, ICR1, voltage_setpoint_get(), voltage_get(), time);
-                        break;
-            }
-        }
-        
-        buttonry_tick();
+    sched_init(tasks, NTASKS);
+    sched_signal(SCHED_RTC | SCHED_UART);
     
-        if ((blinktick & _BV(1)) != 0) {        
-            blinktick &= ~_BV(1);
-            if (blinkhandler != NULL) {
-                blinkhandler(1);
-            }
-        }
-        
-        if (skip != 0) {
-            skip--;
-        } else {
-            mmss = rtc_gettime(1);
-            if (!is_setting() && mmss != mmss1) {
-                mmss1 = mmss;
-                cli(); blinkctr = 0; sei();
-            }
-            
-            rtime = rtc_gettime(0);
-            
-            update_daylight(rtime);
-            
-            savingmode_keep(rtime);
-            
-            switch (mode_get()) {
-                case HHMM:
-                    rtime = rtc_gettime(0);
-                    break;
-                case MMSS:
-                    rtime = mmss;
-                    break;
-                case VOLTAGE:
-                    rtime = voltage_getbcd();
-                    break;
-            }
-            
-            if (!is_setting() && rtime != time && rtime != timef) {
-                fadeto(rtime);
-            }     
-        }
-        
-        // just waste time
-        while((blinktick & _BV(2)) == 0) {
-            sleep_enable();
-            sleep_cpu();
-        }
-        blinktick &= ~_BV(2);
+    for(;;) {
+        wdt_reset();
+        sched_run();
     }
 }
 
@@ -1,6 +1,8 @@
 #include <inttypes.h>
+#include <avr/pgmspace.h>
 #include "util.h"
 #include "modes.h"
+#include "sched.h"
 
 ////
 //// Fade mode
@@ -8,22 +10,41 @@
 
 static volatile uint8_t fademode;      //!< \see _fademode
 
-volatile uint16_t fadetime_full;
-volatile uint16_t fadetime_quart;
+/// Duty of the old digit, in 1/FADEDUTY_MAX of the digit's lit ticks, indexed by steps left in fade.
+/// display_render() turns it into a cathode switch tick in each of the digit's frame slots.
+/// FADE_ON: new digit brightness rises perceptually linear, gamma 2.2
+static const uint8_t fadecurve_on[FADESTEPS+1] PROGMEM = {
+     0,  4,  8, 12, 15, 18, 21, 23, 25, 27, 28, 30, 30, 31, 32, 32, 32
+};
+
+/// FADE_SLOW: smoothstep in perceptual space, gamma 2.2
+static const uint8_t fadecurve_slow[FADESTEPS_S+1] PROGMEM = {
+     0,  0,  1,  2,  3,  4,  6,  8, 10, 12, 14, 16, 18, 20, 22, 24, 25, 
+    26, 28, 29, 29, 30, 31, 31, 31, 32, 32, 32, 32, 32, 32, 32, 32
+};
+
+const uint8_t *fade_curve = fadecurve_on;   //!< current fade curve, in flash
+volatile uint8_t fade_steps = FADESTEPS;    //!< length of fade_curve
+volatile uint8_t fade_rate = FADETIME/FADESTEPS; //!< slow cycles per step
+volatile uint8_t fade_cascade = FADECASCADE;    //!< steps between digits starting to fade
 
 void fade_set(uint8_t mode) {
     switch (mode) {
         case FADE_ON:
-            fadetime_full = FADETIME;
-            fadetime_quart = FADETIME/4;
+            fade_curve = fadecurve_on;
+            fade_steps = FADESTEPS;
+            fade_rate = FADETIME/FADESTEPS;
+            fade_cascade = FADECASCADE;
             fademode = FADE_ON;
             break;
         case FADE_OFF:
             fademode = FADE_OFF;
             break;
         case FADE_SLOW:
-            fadetime_full = FADETIME_S;
-            fadetime_quart = FADETIME_S/4;
+            fade_curve = fadecurve_slow;
+            fade_steps = FADESTEPS_S;
+            fade_rate = FADETIME_S/FADESTEPS_S;
+            fade_cascade = FADECASCADE_S;
             fademode = FADE_ON;
             break;
     }
@@ -40,6 +61,7 @@ volatile uint8_t dotmode;
 
 void dotmode_set(uint8_t mode) {
     dotmode = mode;
+    sched_signal(SCHED_DISPLAY);
 }
 
 
@@ -51,7 +73,12 @@ volatile uint8_t display_mode = HHMM;   //!< current display mode. \see _display
 
 
 void mode_next() {
-    display_mode = (display_mode + 1) % NDISPLAYMODES;
+    mode_set((display_mode + 1) % NDISPLAYMODES);
+}
+
+/// Set display mode along with its fade and dot modes
+void mode_set(uint8_t mode) {
+    display_mode = mode;
     switch (display_mode) {
         case HHMM:  fade_set(FADE_SLOW);
                     dotmode_set(DOT_BLINK);
@@ -76,6 +103,7 @@ volatile uint8_t blinkmode;     //!< current blinking mode
 
 void blinkmode_set(uint8_t mode) {
     blinkmode = mode;
+    sched_signal(SCHED_DISPLAY);
 }
 
 inline uint8_t blinkmode_get() { return blinkmode; }
@@ -95,7 +123,15 @@ void savingmode_set(uint8_t s) {
 inline uint8_t savingmode_get() { return savingmode; }
 
 void savingmode_next() {
-    savingmode_set((savingmode_get() + 1) % 3);
+    savingmode_set((savingmode_get() + 1) % NSAVINGMODES);
+}
+
+/// Return 1 if hhmm is within the SAVEDARK window, which may span midnight
+uint8_t savingmode_dark(uint16_t hhmm) {
+    if (DARK_FROM < DARK_TO) {
+        return hhmm >= DARK_FROM && hhmm < DARK_TO;
+    } 
+    return hhmm >= DARK_FROM || hhmm < DARK_TO;
 }
 
 
@@ -2,8 +2,15 @@
 #define _MODES_H_
 
 #define FADETIME    128        //<! Transition time for xfading digits, in tmr0 overflow-counts
+#define FADESTEPS   16         //<! Steps in FADE_ON curve
 
 #define FADETIME_S  256        //<! Slow transition time
+#define FADESTEPS_S 32         //<! Steps in FADE_SLOW curve
+
+#define FADEDUTY_MAX 32        //<! Fade duty is in 1/32ths
+
+#define FADECASCADE   0        //<! FADE_ON: steps between changing digits starting to fade, 0 = all at once
+#define FADECASCADE_S 0        //<! FADE_SLOW cascade. Keep FADESTEPS_S + 3 * FADECASCADE_S < 128
 
 /// Fade modes. 
 /// Fade is off for in setup and voltmeter modes
@@ -13,8 +20,10 @@ enum _fademode {
     FADE_SLOW
 };
 
-extern volatile uint16_t fadetime_full;
-extern volatile uint16_t fadetime_quart;
+extern const uint8_t *fade_curve;
+extern volatile uint8_t fade_steps;
+extern volatile uint8_t fade_rate;
+extern volatile uint8_t fade_cascade;
 
 void fade_set(uint8_t mode);
 enum _fademode fade_get();
@@ -39,6 +48,7 @@ enum _displaymode {
 };
 
 void mode_next();
+void mode_set(uint8_t mode);
 inline uint8_t mode_get();
 
 /// Blinking modes, see timer0 overflow interrupt
@@ -56,15 +66,22 @@ void blinkmode_set(uint8_t mode);
 uint8_t blinkmode_get();
 
 /// Saving modes
+#define NSAVINGMODES 4
 enum _savinmode {
     WASTE = 0,              //!< Full-on all the time
     SAVE,                   //!< constantly preserve
     SAVENIGHT,              //!< preserve 00:00-08:00
+    SAVEDARK,               //!< SAVENIGHT, tubes and HV completely off DARK_FROM-DARK_TO
 };
 
+#define DARK_FROM   0x0100  //!< SAVEDARK: tubes go off at, BCD HHMM
+#define DARK_TO     0x0600  //!< SAVEDARK: tubes come back on at, BCD HHMM
+#define DARK_WAKE   30      //!< SAVEDARK: seconds to keep the tubes on after a button wakes up the clock
+
 void savingmode_set(uint8_t s);
 uint8_t savingmode_get();
 void savingmode_next();
+uint8_t savingmode_dark(uint16_t hhmm);
 
 
 
@@ -0,0 +1,60 @@
+///\file profile.c
+///\brief ISR profiler on a free-running Timer2, \see profile.h
+
+#include <inttypes.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "usrat.h"
+#include "profile.h"
+
+#ifdef PROFILE
+
+PROF prof[NPROF];
+
+/// Start Timer2 free-running at F_CPU/8 and clear the profiles
+void prof_init() {
+    uint8_t i;
+    
+    cli();
+    memset(prof, 0, sizeof(prof));
+    for (i = 0; i < NPROF; i++) {
+        prof[i].mingap = 255;
+    }
+    TCCR2 = _BV(CS21);
+    sei();
+}
+
+/// Get a consistent copy of a profile
+void prof_get(uint8_t isr, PROF *p) {
+    cli();
+    *p = prof[isr];
+    sei();
+    
+    p->jitter = p->maxgap > p->mingap ? p->maxgap - p->mingap : 0;
+}
+
+/// Print all profiles on the console
+void prof_print() {
+    static const char names[NPROF][4] PROGMEM = { "T0 ", "ADC", "RXC" };
+    PROF p;
+    uint8_t i, b;
+    
+    for (i = 0; i < NPROF; i++) {
+        prof_get(i, &p);
+        uart_printf_P(PSTR("%S max=%d jit=%d gap=%d..%d "), names[i], 
+            p.max, p.jitter, p.mingap, p.maxgap);
+        if (i == PROF_TIMER0) {
+            uart_printf_P(PSTR("lat=%d "), p.latency);
+        }
+        uart_printf_P(PSTR("hist="));
+        for (b = 0; b < PROF_BUCKETS; b++) {
+            uart_printf_P(PSTR("%u "), p.hist[b]);
+        }
+        uart_printf_P(PSTR("\n"));
+    }
+}
+
+#endif
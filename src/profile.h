@@ -0,0 +1,81 @@
+///\file profile.h
+///\brief ISR profiler on a free-running Timer2
+///
+/// Define PROFILE to timestamp entry and exit of TIMER0_OVF_vect, ADC_vect 
+/// and USART_RXC_vect. Timer2 runs at F_CPU/8, one tick per microsecond at 
+/// 8MHz, so runs up to 255us are measured. The timestamps themselves are 
+/// part of the measured time. Without PROFILE the hooks compile to nothing 
+/// and Timer2 stays off.
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+//#define PROFILE
+
+/// Profiled interrupts
+enum _prof_isr {
+    PROF_TIMER0 = 0,
+    PROF_ADC,
+    PROF_RXC,
+    NPROF
+};
+
+#define PROF_BUCKETS    8       //!< histogram bucket n holds runs of 2^n..2^(n+1)-1 ticks, 0 also 0
+
+/// Profile of one interrupt, durations in Timer2 ticks
+typedef struct _prof {
+    uint8_t max;                //!< longest run
+    uint8_t latency;            //!< worst entry latency after the overflow, TIMER0_OVF_vect only
+    uint8_t jitter;             //!< spread of entry intervals, maxgap - mingap, set by prof_get()
+    uint8_t mingap;             //!< shortest interval between entries
+    uint8_t maxgap;             //!< longest interval between entries
+    uint8_t last;               //!< timestamp of the last entry
+    uint16_t hist[PROF_BUCKETS];//!< runs by duration
+} PROF;
+
+#ifdef PROFILE
+
+extern PROF prof[NPROF];
+
+/// Record the entry timestamp, must come first in the ISR
+#define prof_enter()        uint8_t prof_t = TCNT2
+
+/// Record the run since prof_enter(), before every return from the ISR
+#define prof_exit(isr)      prof_record(&prof[isr], prof_t)
+
+/// Record TIMER0_OVF_vect entry latency, TCNT0 must not be reloaded yet
+#define prof_latency(tcnt)  { if ((tcnt) > prof[PROF_TIMER0].latency) prof[PROF_TIMER0].latency = (tcnt); }
+
+static inline void prof_record(PROF *p, uint8_t t) {
+    uint8_t ticks = TCNT2 - t;
+    uint8_t gap = t - p->last;
+    uint8_t b = 0;
+    
+    // no interval before the first run
+    if (p->max != 0) {
+        if (gap < p->mingap) p->mingap = gap;
+        if (gap > p->maxgap) p->maxgap = gap;
+    }
+    p->last = t;
+    
+    if (ticks > p->max) p->max = ticks;
+    while (ticks > 1 && b < PROF_BUCKETS - 1) {
+        ticks >>= 1;
+        b++;
+    }
+    p->hist[b]++;
+}
+
+void prof_init();
+void prof_get(uint8_t isr, PROF *p);
+void prof_print();
+
+#else
+
+#define prof_enter()
+#define prof_exit(isr)
+#define prof_latency(tcnt)
+#define prof_init()
+
+#endif
+
+#endif
@@ -0,0 +1,270 @@
+///\file proto.c
+///\brief Framed binary command protocol on the USART, \see proto.h
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/crc16.h>
+
+#include "usrat.h"
+#include "rtc.h"
+#include "cal.h"
+#include "util.h"
+#include "modes.h"
+#include "voltage.h"
+#include "proto.h"
+#include "profile.h"
+#include "sched.h"
+
+/// Parser states
+enum _proto_state {
+    PS_SYNC = 0,                //!< hunting for PROTO_SYNC
+    PS_LEN,
+    PS_DATA,
+    PS_CRC,
+};
+
+static uint8_t state;
+static uint8_t rx[PROTO_MAX];   //!< payload being received
+static uint8_t rxlen;
+static uint8_t rxpos;
+static uint8_t rxcrc;
+
+static uint8_t tx[PROTO_MAX];   //!< reply payload
+static uint8_t txlen;
+
+static uint16_t tlm_period;     //!< scheduler ticks between telemetry frames, 0 = off
+static uint8_t tlm_seq;
+
+static uint16_t crc_errors;     //!< frames dropped for bad CRC
+static uint16_t bad_frames;     //!< frames dropped for bad length
+
+/// Send payload as a frame. Bytes that don't fit in the TX buffer are dropped,
+/// the caller makes room first. TX_BUFFER_SIZE should hold PROTO_MAX + 3 bytes.
+void proto_send(const uint8_t *payload, uint8_t len) {
+    uint8_t crc = _crc_ibutton_update(0, len);
+    
+    uart_putbyte(PROTO_SYNC);
+    uart_putbyte(len);
+    while (len--) {
+        crc = _crc_ibutton_update(crc, *payload);
+        uart_putbyte(*payload++);
+    }
+    uart_putbyte(crc);
+}
+
+/// Append to the reply, execute() makes sure it fits
+static void reply(uint8_t b) {
+    tx[txlen++] = b;
+}
+
+static void reply16(uint16_t w) {
+    reply(w & 0377);
+    reply(w >> 8);
+}
+
+/// Execute commands in rx, collect replies in tx
+static void execute() {
+    uint8_t pos = 0, op, n, status;
+    uint16_t w;
+    
+    txlen = 0;
+    while (pos < rxlen) {
+        op = rx[pos++];
+        n = rxlen - pos;            // argument bytes left
+        status = PROTO_OK;
+        
+        // keep room for PROTO_ERROR reply
+        if (txlen + PROTO_REPLY_MAX > PROTO_MAX - 2) goto error;
+        
+        switch (op) {
+            case PROTO_RTC_READ:
+                if (n < 2) goto error;
+                n = rx[pos + 1];
+                if (rx[pos] + n > RTC_NREGS || txlen + 1 + n > PROTO_MAX - 2) goto error;
+                reply(op);
+                rtc_readblock(rx[pos], &tx[txlen], n);
+                txlen += n;
+                pos += 2;
+                continue;
+            case PROTO_RTC_WRITE:
+                if (n < 2 || n - 2 < rx[pos + 1]) goto error;
+                n = rx[pos + 1];
+                if (rx[pos] + n > RTC_NREGS) {
+                    status = PROTO_BADARG;
+                } else {
+                    rtc_writeblock(rx[pos], &rx[pos + 2], n);
+                    if (rx[pos] <= RTC_YEAR) {
+                        sched_signal(SCHED_RTC);    // time or date written
+                    }
+                }
+                pos += 2 + n;
+                break;
+            case PROTO_MODE_GET:
+                reply(op);
+                reply(mode_get());
+                reply(savingmode_get());
+                reply(fade_get());
+                reply(dotmode);
+                reply(dst_get());
+                continue;
+            case PROTO_MODE_SET:
+                if (n < 2) goto error;
+                if (rx[pos] >= NDISPLAYMODES || rx[pos + 1] >= NSAVINGMODES) {
+                    status = PROTO_BADARG;
+                } else {
+                    if (rx[pos] != mode_get()) {
+                        mode_set(rx[pos]);
+                    }
+                    savingmode_set(rx[pos + 1]);
+                }
+                pos += 2;
+                break;
+            case PROTO_VOLTAGE_GET:
+                reply(op);
+                reply16(voltage_level_get(VOLTAGE_LEVEL_WASTE));
+                reply16(voltage_level_get(VOLTAGE_LEVEL_SAVE));
+                reply16(voltage_setpoint_get());
+                reply16(voltage_get());
+                continue;
+            case PROTO_VOLTAGE_SET:
+                if (n < 3) goto error;
+                w = rx[pos + 1] | (rx[pos + 2] << 8);
+                if (!voltage_level_set(rx[pos], w)) {
+                    status = PROTO_BADARG;
+                }
+                pos += 3;
+                break;
+            case PROTO_DISPLAY:
+                if (n < 3) goto error;
+                display_override(rx[pos] | (rx[pos + 1] << 8), rx[pos + 2]);
+                pos += 3;
+                break;
+            case PROTO_TELEMETRY:
+                if (n < 2) goto error;
+                tlm_period = rx[pos] | (rx[pos + 1] << 8);
+                sched_signal(SCHED_PROTO);
+                pos += 2;
+                break;
+            case PROTO_DST_SET:
+                if (n < 1) goto error;
+                if (!dst_set(rx[pos])) {
+                    status = PROTO_BADARG;
+                }
+                pos += 1;
+                break;
+            case PROTO_STATS:
+                reply(op);
+                reply16(uart_rx_overruns());
+                reply16(uart_rx_frame_errors());
+                reply16(crc_errors);
+                reply16(bad_frames);
+                reply16(uart_tx_dropped());
+                continue;
+            default:
+                goto error;
+        }
+        
+        reply(op);
+        reply(status);
+    }
+    
+    // the reply goes out whole, even when console text or telemetry came first
+    uart_tx_wait(txlen + 3);
+    proto_send(tx, txlen);
+    return;
+    
+error:
+    reply(PROTO_ERROR);
+    reply(op);
+    uart_tx_wait(txlen + 3);
+    proto_send(tx, txlen);
+}
+
+/// Send a telemetry frame, called by the main loop when one is due.
+/// \return scheduler ticks until the next frame, SCHED_MAXDELAY when off
+uint16_t proto_tick() {
+    TELEMETRY t;
+#ifdef PROFILE
+    PROF p;
+#endif
+    
+    if (tlm_period == 0) {
+        return SCHED_MAXDELAY;
+    }
+    
+    t.tag = PROTO_TLM;
+    t.seq = tlm_seq++;
+    // skipped rather than waited for, replies wait in execute()
+    if (uart_tx_free() < sizeof(TELEMETRY) + 3) {
+        return tlm_period;
+    }
+    
+    t.xbits = VOLTAGE_XBITS;
+    t.regulator = voltage_regulator_get();
+    t.voltage = voltage_get_hr();
+    t.setpoint = voltage_setpoint_get();
+    t.ocr1a = OCR1A;
+    t.icr1 = ICR1;
+    t.display = get_display_value();
+    cli();
+    t.blinkctr = blinkctr;
+    sei();
+    t.persec = secmeasured;
+    t.slowctr = slowctr;
+#ifdef PROFILE
+    prof_get(PROF_TIMER0, &p);
+    t.t0max = p.max;
+    t.t0latency = p.latency;
+    prof_get(PROF_ADC, &p);
+    t.adcmax = p.max;
+    t.adcjitter = p.jitter;
+    prof_get(PROF_RXC, &p);
+    t.rxcmax = p.max;
+#endif
+    
+    proto_send((uint8_t *) &t, sizeof(TELEMETRY));
+    return tlm_period;
+}
+
+/// Feed a received byte to the frame parser. Never blocks, 
+/// a complete frame is executed and answered right away.
+/// \return 1 if the byte belongs to a frame, 0 if it's for the console
+uint8_t proto_rx(uint8_t c) {
+    switch (state) {
+        case PS_SYNC:
+            if (c != PROTO_SYNC) {
+                return 0;
+            }
+            state = PS_LEN;
+            break;
+        case PS_LEN:
+            if (c == 0 || c > PROTO_MAX) {
+                bad_frames++;
+                state = PS_SYNC;
+                break;
+            }
+            rxlen = c;
+            rxpos = 0;
+            rxcrc = _crc_ibutton_update(0, c);
+            state = PS_DATA;
+            break;
+        case PS_DATA:
+            rx[rxpos++] = c;
+            rxcrc = _crc_ibutton_update(rxcrc, c);
+            if (rxpos == rxlen) {
+                state = PS_CRC;
+            }
+            break;
+        case PS_CRC:
+            state = PS_SYNC;
+            if (c != rxcrc) {
+                crc_errors++;
+                break;
+            }
+            execute();
+            break;
+    }
+    
+    return 1;
+}
@@ -0,0 +1,84 @@
+///\file proto.h
+///\brief Framed binary command protocol on the USART
+///
+/// Frame: PROTO_SYNC, length, payload[length], CRC8 of length and payload 
+/// (Dallas/iButton polynomial). The payload is a batch of commands, each an 
+/// opcode followed by its arguments. They are executed in order and the 
+/// replies are batched into one reply frame, each reply starting with 
+/// the opcode it answers. Multibyte values are little-endian.
+///
+/// Commands and replies:
+/// - PROTO_RTC_READ addr n          -> PROTO_RTC_READ data[n]
+/// - PROTO_RTC_WRITE addr n data[n] -> PROTO_RTC_WRITE status
+/// - PROTO_MODE_GET                 -> PROTO_MODE_GET display saving fade dot dst
+/// - PROTO_MODE_SET display saving  -> PROTO_MODE_SET status
+/// - PROTO_VOLTAGE_GET              -> PROTO_VOLTAGE_GET waste16 save16 setpoint16 voltage16
+/// - PROTO_VOLTAGE_SET level setpoint16 -> PROTO_VOLTAGE_SET status, \see _voltage_level
+/// - PROTO_DISPLAY bcd16 seconds    -> PROTO_DISPLAY status, 0 seconds releases the display
+/// - PROTO_STATS                    -> PROTO_STATS overruns16 uartframe16 crc16 badframe16 txdropped16
+/// - PROTO_TELEMETRY period16       -> PROTO_TELEMETRY status, period in 1.6ms scheduler ticks, 0 stops
+/// - PROTO_DST_SET zone             -> PROTO_DST_SET status, \see _dst_zone
+///
+/// While telemetry is on, a PROTO_TLM frame is sent every period, see TELEMETRY.
+/// Frames that don't fit in the TX buffer are skipped, which shows as a 
+/// gap in seq. Replies wait for room and are never dropped.
+///
+/// An unknown or truncated command, or one whose reply wouldn't fit, is 
+/// answered with PROTO_ERROR opcode and ends the batch.
+#ifndef _PROTO_H_
+#define _PROTO_H_
+
+#define PROTO_SYNC      0xa5    //!< frame start, never seen in console text
+#define PROTO_MAX       32      //!< max payload length of a frame, both ways
+#define PROTO_REPLY_MAX 11      //!< longest reply other than PROTO_RTC_READ
+
+/// Status returned by setters
+enum _proto_status {
+    PROTO_OK = 0,
+    PROTO_BADARG,               //!< argument out of range, nothing changed
+};
+
+/// Command opcodes
+enum _proto_op {
+    PROTO_RTC_READ = 1,
+    PROTO_RTC_WRITE,
+    PROTO_MODE_GET,
+    PROTO_MODE_SET,
+    PROTO_VOLTAGE_GET,
+    PROTO_VOLTAGE_SET,
+    PROTO_DISPLAY,
+    PROTO_STATS,
+    PROTO_TELEMETRY,
+    PROTO_DST_SET,
+    PROTO_TLM = 0x80,           //!< unsolicited telemetry frame tag
+    PROTO_ERROR = 0xff,
+};
+
+/// Telemetry frame payload, packed so the wire layout doesn't depend on the ABI
+typedef struct __attribute__ ((packed)) _telemetry {
+    uint8_t tag;                //!< PROTO_TLM
+    uint8_t seq;                //!< frame counter, gaps are skipped frames
+    uint8_t xbits;              //!< extra bits in voltage, VOLTAGE_XBITS
+    uint8_t regulator;          //!< \see _regulator
+    uint16_t voltage;           //!< HV feedback, oversampled
+    uint16_t setpoint;          //!< HV setpoint
+    uint16_t ocr1a;
+    uint16_t icr1;
+    uint16_t display;           //!< BCD display value
+    uint16_t blinkctr;          //!< phase within the second, in slow cycles
+    uint16_t persec;            //!< slow cycles in the last RTC second
+    uint8_t slowctr;            //!< slow cycle counter
+#ifdef PROFILE
+    uint8_t t0max;              //!< longest TIMER0_OVF_vect, Timer2 ticks, \see profile.h
+    uint8_t t0latency;          //!< worst TIMER0_OVF_vect entry latency
+    uint8_t adcmax;             //!< longest ADC_vect
+    uint8_t adcjitter;          //!< spread of ADC_vect entry intervals
+    uint8_t rxcmax;             //!< longest USART_RXC_vect
+#endif
+} TELEMETRY;
+
+uint8_t proto_rx(uint8_t c);
+uint16_t proto_tick();
+void proto_send(const uint8_t *payload, uint8_t len);
+
+#endif
@@ -1,10 +1,11 @@
 #include <avr/io.h>
 #include <avr/pgmspace.h>
-#include <stdio.h>
 #include <inttypes.h>
 
+#include "usrat.h"
 #include "util.h"
 #include "rtc.h"
+#include "hal.h"
 
 #define DDRRTCSEL    DDRB
 #define PORTRTCSEL   PORTB
@@ -17,9 +18,9 @@
 #define MOSI        3
 #define SCK         5
 
-static void spi_wait() {
-    while (!(SPSR & _BV(SPIF)));
-}
+#define DDRRTCINT   DDRD
+#define PORTRTCINT  PORTD
+#define RTCINT      2
 
 void rtc_init() {
     //DDRD |= _BV(4);     // RTCSEL#
@@ -31,23 +32,67 @@ void rtc_init() {
     PORTRTCSEL |= _BV(RTCSEL);
     
     SPCR = BV4(SPE, MSTR, CPHA, SPR1);
+
+#ifdef RTC_SQW_INT0
+    rtc_int_sqw();
+#endif
+}
+
+/// 1Hz square wave on INT#/SQW, INT0 on falling edge
+void rtc_int_sqw() {
+    // oscillator on, INTCN = 0, RS2:1 = 00: 1Hz square wave on INT#/SQW
+    rtc_rw(RTC_CONTROL, 0);
+    rtc_alarm_ack();
+    
+    // SQW is open drain, falling edge is when the seconds register changes
+    DDRRTCINT &= ~_BV(RTCINT);
+    PORTRTCINT |= _BV(RTCINT);
+    MCUCR = (MCUCR & ~BV2(ISC01,ISC00)) | _BV(ISC01);
+    GIFR = _BV(INTF0);
+    GICR |= _BV(INT0);
 }
 
-void rtc_send(uint8_t b) {
+/// Alarm 1 every second on INT#, which then stays low until rtc_alarm_ack().
+/// INT0 is set to low level, the only kind that wakes up from power down.
+/// INT0 is left disabled, enable it right before going to sleep.
+void rtc_int_alarm() {
+    uint8_t i;
+    
+    GICR &= ~_BV(INT0);
+    MCUCR &= ~BV2(ISC01,ISC00);
+    
+    // A1M1..A1M4 = 1: alarm once per second
+    for (i = RTC_ALARM1; i < RTC_ALARM1 + 4; i++) {
+        rtc_rw(i, 0200);
+    }
+    rtc_alarm_ack();
+    rtc_rw(RTC_CONTROL, BV2(RTC_INTCN, RTC_A1IE));
+}
+
+/// Clear alarm flags, release INT#
+void rtc_alarm_ack() {
+    rtc_rw(RTC_STATUS, rtc_rw(RTC_STATUS, -1) & ~BV2(1,0));
+}
+
+/// Select the RTC and exchange a byte with it
+uint8_t rtc_send(uint8_t b) {
     PORTRTCSEL &= ~_BV(RTCSEL); 
-    SPDR = b;
-    spi_wait();
+    return hal_spi_xfer(b);
 }
 
+/// End the transaction
 void rtc_over() {
     PORTRTCSEL |= _BV(RTCSEL);
+    hal_spi_end();
 }
 
 uint8_t rtc_rw(uint8_t addr, int8_t value) {
+    uint8_t result;
+    
     rtc_send(addr | (value == -1 ? 0 : 0200));
-    rtc_send(value);
+    result = rtc_send(value);
     rtc_over();
-    return SPDR;
+    return result;
 }
 
 uint16_t rtc_gettime(uint8_t ss) {
@@ -57,26 +102,55 @@ uint16_t rtc_gettime(uint8_t ss) {
     rtc_send(ss ? 0 : 1);
 
     // data 1
-    rtc_send(0);
-    time = SPDR; 
+    time = rtc_send(0);
     
     // data 2
-    rtc_send(0);
-    while (!(SPSR & _BV(SPIF)));
-    time |= SPDR<<8;
+    time |= rtc_send(0) << 8;
     
     rtc_over();
           
     return time; 
 }
 
+/// Read time and date registers 0x00..0x06 in one SPI transaction
+void rtc_read(RTC_TIME *t) {
+    rtc_send(0);
+    
+    t->second = rtc_send(0);
+    t->minute = rtc_send(0);
+    t->hour = rtc_send(0);
+    t->dow = rtc_send(0);
+    t->day = rtc_send(0);
+    t->month = rtc_send(0);
+    t->year = rtc_send(0);
+    
+    rtc_over();
+}
+
+/// Read n registers starting at addr in one SPI transaction
+void rtc_readblock(uint8_t addr, uint8_t *buf, uint8_t n) {
+    rtc_send(addr);
+    while (n--) {
+        *buf++ = rtc_send(0);
+    }
+    rtc_over();
+}
+
+/// Write n registers starting at addr in one SPI transaction
+void rtc_writeblock(uint8_t addr, const uint8_t *buf, uint8_t n) {
+    rtc_send(addr | 0200);
+    while (n--) {
+        rtc_send(*buf++);
+    }
+    rtc_over();
+}
+
 void rtc_dump() {
     uint8_t i;
     
     rtc_send(0); 
-    for (i = 0; i < 0x1a; i++) {
-        rtc_send(0); 
-        printf_P(PSTR("%02x:%02x   "), i, SPDR);
+    for (i = 0; i < RTC_NREGS; i++) {
+        uart_printf_P(PSTR("%02x:%02x   "), i, rtc_send(0));
     }
     rtc_over();
 }
@@ -1,14 +1,37 @@
 #ifndef _RTC_H
 #define _RTC_H
 
+/// DS3234 INT#/SQW (RTCINT) drives INT0 with 1Hz square wave.
+/// Undefine to poll the RTC on every main loop tick instead.
+#define RTC_SQW_INT0
+
+/// DS3234 registers
+#define RTC_YEAR    0x06    //!< last of the time and date registers 0x00..0x06
+#define RTC_ALARM1  0x07
+#define RTC_CONTROL 0x0e
+#define RTC_STATUS  0x0f
+#define RTC_NREGS   0x1a    //!< registers 0x00..0x19, including SRAM address/data
+
+/// DS3234 control register bits
+#define RTC_INTCN   2
+#define RTC_A1IE    0
+
 typedef struct _rtc_time {
     uint8_t hour;
     uint8_t minute;
     uint8_t year;
     uint8_t month;
     uint8_t day;
+    uint8_t second;
+    uint8_t dow;
 } RTC_TIME;
 
+/// BCD HHMM of a time snapshot
+#define rtc_hhmm(t) maketime((t)->hour, (t)->minute)
+
+/// BCD MMSS of a time snapshot
+#define rtc_mmss(t) maketime((t)->minute, (t)->second)
+
 #define rtc_xseconds(x) rtc_rw(0,x);
 
 #define rtc_xminute(x) rtc_rw(1,x)
@@ -24,10 +47,16 @@ typedef struct _rtc_time {
 #define rtc_xdow(x) rtc_rw(3,x)
 
 void rtc_init();
-void rtc_send(uint8_t b);
+void rtc_int_sqw();
+void rtc_int_alarm();
+void rtc_alarm_ack();
+uint8_t rtc_send(uint8_t b);
 void rtc_over();
 uint16_t rtc_gettime(uint8_t);
+void rtc_read(RTC_TIME *t);
 uint8_t rtc_rw(uint8_t addr, int8_t value);
+void rtc_readblock(uint8_t addr, uint8_t *buf, uint8_t n);
+void rtc_writeblock(uint8_t addr, const uint8_t *buf, uint8_t n);
 
 void rtc_dump();
 
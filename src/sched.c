@@ -0,0 +1,110 @@
+///\file sched.c
+///\brief Deadline scheduler for the main loop, \see sched.h
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "usrat.h"
+#include "profile.h"
+#include "sched.h"
+#include "hal.h"
+
+volatile uint16_t sched_clock;      //!< ticks since boot, wraps
+volatile uint8_t sched_events;      //!< raised events, cleared when tasks have seen them
+
+static TASK *tasks;
+static uint8_t ntasks;
+
+/// Current tick
+uint16_t sched_now() {
+    uint16_t now;
+
+    cli();
+    now = sched_clock;
+    sei();
+    return now;
+}
+
+/// Start scheduling tasks, periodic ones are all due now
+void sched_init(TASK *t, uint8_t n) {
+    uint16_t now = sched_now();
+    uint8_t i;
+
+    tasks = t;
+    ntasks = n;
+    for (i = 0; i < n; i++) {
+        t[i].due = now;
+    }
+}
+
+/// Raise events outside of interrupt handlers
+void sched_signal(uint8_t ev) {
+    cli();
+    sched_events |= ev;
+    sei();
+}
+
+/// Don't run task for ticks, its events still run it. A periodic task
+/// may call it on itself to pick the time of its next run.
+void sched_defer(uint8_t task, uint16_t ticks) {
+    if (ticks > SCHED_MAXDELAY) {
+        ticks = SCHED_MAXDELAY;
+    }
+    tasks[task].due = sched_now() + ticks;
+}
+
+/// Run the tasks that are due, in table order, then sleep until the
+/// nearest deadline or event. A late task runs once, missed periods
+/// are not made up for.
+void sched_run() {
+    TASK *t;
+    uint8_t i, ev;
+    uint16_t now;
+    int16_t wait = SCHED_MAXDELAY;
+
+    cli();
+    ev = sched_events;
+    sched_events = 0;
+    now = sched_clock;
+    sei();
+
+    for (i = 0, t = tasks; i < ntasks; i++, t++) {
+        if (t->events & ev) {
+            // due again a period from now, unless the task defers itself
+            t->due = now + t->period;
+            t->run();
+        } else if (t->period != 0 && (int16_t)(now - t->due) >= 0) {
+#ifdef PROFILE
+            if (now - t->due > t->late) {
+                t->late = now - t->due;
+            }
+#endif
+            t->due = now + t->period;
+            t->run();
+        }
+    }
+
+    for (i = 0, t = tasks; i < ntasks; i++, t++) {
+        if (t->period != 0 && (int16_t)(t->due - now) < wait) {
+            wait = t->due - now;
+        }
+    }
+    
+    now += wait;
+    while (sched_events == 0 && (int16_t)(sched_now() - now) < 0) {
+        hal_sleep();
+    }
+}
+
+#ifdef PROFILE
+/// Print worst lateness of each task on the console
+void sched_print() {
+    uint8_t i;
+
+    for (i = 0; i < ntasks; i++) {
+        uart_printf_P(PSTR("task %d late=%u\n"), i, tasks[i].late);
+    }
+}
+#endif
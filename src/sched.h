@@ -0,0 +1,51 @@
+///\file sched.h
+///\brief Deadline scheduler for the main loop
+///
+/// The main loop is a table of TASKs. A task runs when its period is up or
+/// when one of its events is raised, and the CPU sleeps until the nearest
+/// deadline or event. Time is counted in sched ticks of 64 Timer0 overflows
+/// (1.6ms), advanced by TIMER0_OVF_vect through sched_tick().
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#define SCHED_MAXDELAY  32767   //!< longest period or deferral in ticks, 52s
+
+/// Events that make tasks due right away
+enum _sched_event {
+    SCHED_RTC = 1,              //!< the second has changed or the time was set
+    SCHED_UART = 2,             //!< bytes received
+    SCHED_DISPLAY = 4,          //!< something new to show, \see task_display()
+    SCHED_PROTO = 8,            //!< telemetry period changed
+};
+
+/// A task of the main loop
+typedef struct _task {
+    void (*run)(void);
+    uint16_t period;            //!< ticks between runs, 0 = on events only
+    uint8_t events;             //!< events that run the task, \see _sched_event
+    uint16_t due;               //!< tick of the next periodic run
+#ifdef PROFILE
+    uint16_t late;              //!< most ticks a periodic run came after due
+#endif
+} TASK;
+
+extern volatile uint16_t sched_clock;
+extern volatile uint8_t sched_events;
+
+/// Advance the clock, called from TIMER0_OVF_vect every tick
+#define sched_tick()            (sched_clock++)
+
+/// Raise events from an interrupt handler
+#define sched_signal_isr(ev)    (sched_events |= (ev))
+
+void sched_init(TASK *tasks, uint8_t n);
+void sched_run();
+void sched_signal(uint8_t ev);
+void sched_defer(uint8_t task, uint16_t ticks);
+uint16_t sched_now();
+
+#ifdef PROFILE
+void sched_print();
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+///\file settings.c
+///\brief Settings kept in EEPROM across power cycles
+///
+/// Settings are written as SETTINGS records into a ring of SETTINGS_SLOTS 
+/// slots, each write goes to the slot after the newest one. A write only 
+/// happens after the settings stayed the same for SETTINGS_IDLE seconds, 
+/// so cycling through modes with a button costs one write. The record is
+/// written a byte at a time by settings_poll(), so the main loop never 
+/// waits for the EEPROM. A record cut short by a reset fails its crc.
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "voltage.h"
+#include "settings.h"
+#include "modes.h"
+#include "rtc.h"
+#include "cal.h"
+
+static SETTINGS ring[SETTINGS_SLOTS] EEMEM;
+
+static SETTINGS stored;         //!< last record written or restored
+static uint8_t slot;            //!< ring slot of stored
+static uint8_t written = sizeof(SETTINGS);  //!< bytes of stored already in its slot
+static SETTINGS pending;        //!< settings waiting to become idle
+static uint8_t idle;            //!< seconds pending has been unchanged
+
+static uint8_t settings_crc(SETTINGS *s) {
+    uint8_t *p = (uint8_t *) s;
+    uint8_t i, crc = 0;
+    
+    for (i = 0; i < offsetof(SETTINGS, crc); i++) {
+        crc = _crc_ibutton_update(crc, *p++);
+    }
+    
+    return crc;
+}
+
+/// Fill s with current settings
+static void settings_get(SETTINGS *s) {
+    s->mode = mode_get();
+    s->savingmode = savingmode_get();
+    s->levels[VOLTAGE_LEVEL_WASTE] = voltage_level_get(VOLTAGE_LEVEL_WASTE);
+    s->levels[VOLTAGE_LEVEL_SAVE] = voltage_level_get(VOLTAGE_LEVEL_SAVE);
+    s->dst = dst_get();
+}
+
+/// 1 if a and b hold the same settings, sequence and crc aside
+static uint8_t settings_same(SETTINGS *a, SETTINGS *b) {
+    return a->mode == b->mode && a->savingmode == b->savingmode && 
+        a->levels[VOLTAGE_LEVEL_WASTE] == b->levels[VOLTAGE_LEVEL_WASTE] &&
+        a->levels[VOLTAGE_LEVEL_SAVE] == b->levels[VOLTAGE_LEVEL_SAVE] &&
+        a->dst == b->dst;
+}
+
+/// Find the newest valid record in the ring and apply it. 
+/// Defaults stay if there is none.
+void settings_restore() {
+    SETTINGS s;
+    uint8_t i, found = 0;
+    
+    for (i = 0; i < SETTINGS_SLOTS; i++) {
+        eeprom_read_block(&s, &ring[i], sizeof(SETTINGS));
+        if (s.version != SETTINGS_VERSION || s.crc != settings_crc(&s)) {
+            continue;
+        }
+        if (!found || (int8_t)(s.seq - stored.seq) > 0) {
+            stored = s;
+            slot = i;
+            found = 1;
+        }
+    }
+    
+    if (found) {
+        mode_set(stored.mode);
+        savingmode_set(stored.savingmode);
+        voltage_level_set(VOLTAGE_LEVEL_WASTE, stored.levels[VOLTAGE_LEVEL_WASTE]);
+        voltage_level_set(VOLTAGE_LEVEL_SAVE, stored.levels[VOLTAGE_LEVEL_SAVE]);
+        dst_set(stored.dst);
+    } else {
+        // nothing to restore, next write starts the ring at slot 0
+        settings_get(&stored);
+        stored.seq = 0;
+        slot = SETTINGS_SLOTS - 1;
+    }
+    pending = stored;
+}
+
+/// Call once a second. Writes settings after they've been idle for SETTINGS_IDLE seconds.
+void settings_tick() {
+    SETTINGS s;
+    
+    settings_get(&s);
+    if (!settings_same(&s, &pending)) {
+        pending = s;
+        idle = 0;
+        return;
+    }
+    
+    if (idle < SETTINGS_IDLE) {
+        idle++;
+        return;
+    }
+    
+    if (written < sizeof(SETTINGS) || settings_same(&pending, &stored)) {
+        return;
+    }
+    
+    slot = (slot + 1) % SETTINGS_SLOTS;
+    pending.version = SETTINGS_VERSION;
+    pending.seq = stored.seq + 1;
+    pending.crc = settings_crc(&pending);
+    stored = pending;
+    written = 0;
+}
+
+/// Main loop task. Writes the next byte of a record settings_tick() 
+/// started, if the EEPROM is done with the previous one.
+void settings_poll() {
+    if (written < sizeof(SETTINGS) && eeprom_is_ready()) {
+        eeprom_write_byte((uint8_t *) &ring[slot] + written, ((uint8_t *) &stored)[written]);
+        written++;
+    }
+}
@@ -0,0 +1,25 @@
+///\file settings.h
+///\brief Settings kept in EEPROM across power cycles
+#ifndef _SETTINGS_H_
+#define _SETTINGS_H_
+
+#define SETTINGS_VERSION    3   //!< bump when SETTINGS layout changes, old records are ignored
+#define SETTINGS_SLOTS      32  //!< records in the EEPROM ring, keep below 128
+#define SETTINGS_IDLE       5   //!< seconds settings must stay unchanged before they're written
+
+/// Settings record, one slot of the EEPROM ring
+typedef struct _settings {
+    uint8_t version;            //!< SETTINGS_VERSION
+    uint8_t seq;                //!< write sequence number, the newest record has the highest
+    uint8_t mode;               //!< display mode, \see _displaymode
+    uint8_t savingmode;         //!< \see _savinmode
+    uint16_t levels[NVOLTAGELEVELS]; //!< voltage setpoints, \see _voltage_level
+    uint8_t dst;                //!< DST rule set, \see _dst_zone
+    uint8_t crc;                //!< Dallas CRC8 of the above
+} SETTINGS;
+
+void settings_restore();
+void settings_tick();
+void settings_poll();
+
+#endif
@@ -0,0 +1,49 @@
+///\file test/bcdtest.c
+///\brief Host test of tobcd16() over 0..999 and voltage_getbcd() over the 
+/// whole ADC range against the division code they replaced, and of tobcd()
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "util.h"
+#include "voltage.h"
+#include "reference.h"
+
+volatile uint8_t hal_io[64];            //!< voltage.c touches the ADC and timer registers
+extern volatile uint16_t voltage;
+
+int main() {
+    uint16_t x, got, want;
+    int failures = 0;
+    
+    for (x = 0; x < 1000; x++) {
+        got = tobcd16(x);
+        want = tobcd16_div(x);
+        if (got != want) {
+            printf("tobcd16(%u) = %04x, expected %04x\n", x, got, want);
+            failures++;
+        }
+    }
+    
+    for (x = 0; x < 100; x++) {
+        got = tobcd(x);
+        want = tobcd16_div(x) & 0377;
+        if (got != want) {
+            printf("tobcd(%u) = %02x, expected %02x\n", x, got, want);
+            failures++;
+        }
+    }
+    
+    for (x = 0; x < 1024; x++) {
+        voltage = x;
+        got = voltage_getbcd();
+        want = voltage_getbcd_div(x);
+        if (got != want) {
+            printf("voltage_getbcd(%u) = %04x, expected %04x\n", x, got, want);
+            failures++;
+        }
+    }
+    
+    printf("bcdtest: %s\n", failures ? "FAIL" : "ok");
+    return failures != 0;
+}
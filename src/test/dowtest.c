@@ -0,0 +1,38 @@
+///\file test/dowtest.c
+///\brief Host test of day_of_week() and days_in_month_bcd() for every date 2000..2099
+///
+/// Checked against a day count from Saturday 2000-01-01 and against the 
+/// loop version day_of_week() replaced.
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "util.h"
+#include "reference.h"
+
+int main() {
+    static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    int y, m, d, n, dow, failures = 0;
+    long count = 6;     // Saturday
+    
+    for (y = 0; y < 100; y++) {
+        for (m = 1; m <= 12; m++) {
+            n = days[m - 1] + (m == 2 && y % 4 == 0);
+            if (days_in_month_bcd(((y / 10) << 4) | (y % 10), ((m / 10) << 4) | (m % 10)) != (((n / 10) << 4) | (n % 10))) {
+                printf("days_in_month_bcd(%d, %d) wrong\n", y, m);
+                failures++;
+            }
+            for (d = 1; d <= n; d++, count++) {
+                dow = day_of_week(y, m, d);
+                if (dow != count % 7 || dow != day_of_week_loop(y, m, d)) {
+                    printf("%04d-%02d-%02d: day_of_week %d, loop %d, expected %ld\n", 
+                        2000 + y, m, d, dow, day_of_week_loop(y, m, d), count % 7);
+                    failures++;
+                }
+            }
+        }
+    }
+    
+    printf("dowtest: %ld dates, %s\n", count - 6, failures ? "FAIL" : "ok");
+    return failures != 0;
+}
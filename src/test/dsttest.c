@@ -0,0 +1,205 @@
+///\file test/dsttest.c
+///\brief Host test of DST transitions 2000..2099 against a brute force calendar
+///
+/// The clock is run an hour at a time through every year of every rule set,
+/// update_daylight() gets the snapshots and must shift the hour exactly on 
+/// the transitions. Then the same with the dark window skipped on transition
+/// days, the missed transitions must be caught up with. A warm reset in the
+/// hour repeated after falling back must not set the clock back again.
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "util.h"
+#include "rtc.h"
+#include "cal.h"
+
+static int rtc_hour = -1;       //!< last hour written to the RTC, -1 if none
+
+uint8_t rtc_rw(uint8_t addr, int8_t value) {
+    if (addr == 2) {
+        rtc_hour = frombcd(value);
+    }
+    return 0;
+}
+
+static uint8_t bcd(int x) {
+    return ((x / 10) << 4) | (x % 10);
+}
+
+/// Days in month m of year 2000 + y, the slow way
+static int ref_month_days(int y, int m) {
+    static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    
+    return days[m - 1] + (m == 2 && y % 4 == 0);
+}
+
+/// Day of week of a date, 0 = Sunday, counted from Saturday 2000-01-01
+static int ref_dow(int y, int m, int d) {
+    long n = 0;
+    int i;
+    
+    for (i = 0; i < y; i++) {
+        n += i % 4 == 0 ? 366 : 365;
+    }
+    for (i = 1; i < m; i++) {
+        n += ref_month_days(y, i);
+    }
+    n += d - 1;
+    
+    return (n + 6) % 7;
+}
+
+/// Day of the week'th Sunday of a month, week 5 is the last one
+static int ref_sunday(int y, int m, int week) {
+    int d, found = 0, last = 0;
+    
+    for (d = 1; d <= ref_month_days(y, m); d++) {
+        if (ref_dow(y, m, d) == 0) {
+            last = d;
+            if (++found == week) {
+                return d;
+            }
+        }
+    }
+    return last;
+}
+
+typedef struct _reftr {
+    int month, week, hour, shift;
+} REFTR;
+
+static const REFTR ref[NDSTZONES - 1][2] = {
+    { { 3, 5, 2, +1 }, { 10, 5, 3, -1 } },      // DST_EU
+    { { 3, 2, 2, +1 }, { 11, 1, 2, -1 } },      // DST_US
+};
+
+static int failures;
+
+/// Run year y of a zone hour by hour, skipping the hours from..to-1 of transition days
+static void run_year(int zone, int y, int from, int to) {
+    RTC_TIME t = { 0 };
+    int m, d, h, i, skip, seen[2] = { 0, 0 };
+    int tday[2];
+    
+    for (i = 0; i < 2; i++) {
+        tday[i] = ref_sunday(y, ref[zone - 1][i].month, ref[zone - 1][i].week);
+    }
+    
+    t.year = bcd(y);
+    for (m = 1; m <= 12; m++) {
+        for (d = 1; d <= ref_month_days(y, m); d++) {
+            for (h = 0; h < 24; h++) {
+                t.month = bcd(m);
+                t.day = bcd(d);
+                t.hour = bcd(h);
+                
+                skip = 0;
+                for (i = 0; i < 2; i++) {
+                    if (m == ref[zone - 1][i].month && d == tday[i] && h >= from && h < to) {
+                        skip = 1;
+                    }
+                }
+                if (skip) {
+                    continue;
+                }
+                
+                rtc_hour = -1;
+                update_daylight(&t);
+                if (rtc_hour < 0) {
+                    continue;
+                }
+                
+                for (i = 0; i < 2; i++) {
+                    const REFTR *r = &ref[zone - 1][i];
+                    int due = r->hour >= from && r->hour < to ? to : r->hour;
+                    
+                    if (m == r->month && d == tday[i] && h == due && !seen[i]) {
+                        break;
+                    }
+                }
+                if (i == 2 || rtc_hour != h + ref[zone - 1][i].shift || frombcd(t.hour) != rtc_hour) {
+                    printf("zone %d %04d-%02d-%02d %02d:00: unexpected shift to %02d\n", 
+                        zone, 2000 + y, m, d, h, rtc_hour);
+                    failures++;
+                } else {
+                    seen[i] = 1;
+                }
+            }
+        }
+    }
+    
+    for (i = 0; i < 2; i++) {
+        if (!seen[i]) {
+            printf("zone %d %04d: transition %d on %02d-%02d missed\n", 
+                zone, 2000 + y, i, ref[zone - 1][i].month, tday[i]);
+            failures++;
+        }
+    }
+}
+
+/// Fall back in year y, then reset as warm_restore() would and run the repeated hour again
+static void reset_after_fallback(int zone, int y) {
+    const REFTR *r = &ref[zone - 1][1];
+    RTC_TIME t = { 0 };
+    uint8_t year, done;
+    int h;
+    
+    t.year = bcd(y);
+    t.month = bcd(r->month);
+    t.day = bcd(ref_sunday(y, r->month, r->week));
+    t.hour = bcd(r->hour - 1);
+    update_daylight(&t);
+    t.hour = bcd(r->hour);
+    rtc_hour = -1;
+    update_daylight(&t);
+    if (rtc_hour != r->hour - 1) {
+        printf("zone %d %04d: no fall back before the reset\n", zone, 2000 + y);
+        failures++;
+        return;
+    }
+    
+    done = dst_applied(&year);
+    dst_restore(year, done);
+    for (h = r->hour - 1; h <= r->hour; h++) {
+        t.hour = bcd(h);
+        rtc_hour = -1;
+        update_daylight(&t);
+        if (rtc_hour >= 0) {
+            printf("zone %d %04d %02d:00: fell back again after a reset\n", zone, 2000 + y, h);
+            failures++;
+        }
+    }
+}
+
+int main() {
+    int zone, y;
+    RTC_TIME july = { 0x12, 0, 0x10, 0x07, 0x01, 0, 0 };
+    
+    for (zone = DST_EU; zone < NDSTZONES; zone++) {
+        dst_set(zone);
+        for (y = 0; y < 100; y++) {
+            run_year(zone, y, 24, 24);
+        }
+        // the dark window of deepnight()
+        for (y = 0; y < 100; y++) {
+            run_year(zone, y, 1, 6);
+        }
+        for (y = 0; y < 100; y++) {
+            reset_after_fallback(zone, y);
+        }
+    }
+    
+    // picking rules in the middle of the year doesn't apply the past transition
+    dst_set(DST_NONE);
+    dst_set(DST_EU);
+    rtc_hour = -1;
+    update_daylight(&july);
+    if (rtc_hour >= 0) {
+        printf("past transition applied after dst_set()\n");
+        failures++;
+    }
+    
+    printf("dsttest: %s\n", failures ? "FAIL" : "ok");
+    return failures != 0;
+}
@@ -0,0 +1,36 @@
+///\file test/reference.c
+///\brief Reference code, \see reference.h
+
+#include <inttypes.h>
+
+#include "util.h"
+#include "reference.h"
+
+uint8_t day_of_week_loop(uint8_t y, uint8_t m, uint8_t d) {
+    uint8_t leap = y%4 == 0;
+    uint16_t centurydays = 6 + y * 365 + (y+3)/4; // year 2000 started on Saturday
+    for (; --m >= 1; ) {
+        centurydays += month_length(m,leap);
+    }
+    
+    centurydays += d-1;
+    
+    return (centurydays % 7);
+}
+
+uint16_t tobcd16_div(uint16_t x) {
+    uint16_t y;
+    
+    y  = x % 10; x /= 10;
+    y |= (x % 10)<<4; x /= 10;
+    y |= (x % 100)<<8; x /= 10;
+    y |= 0xf000;
+    
+    return y;
+}
+
+uint16_t voltage_getbcd_div(uint16_t voltage) {
+    // 1024 = 500V
+    uint16_t val = (voltage * 32) / 65;
+    return tobcd16_div(val);
+}
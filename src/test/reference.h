@@ -0,0 +1,16 @@
+///\file test/reference.h
+///\brief The code that calendar and arithmetic routines replaced, kept as a 
+/// reference for the host tests and bench/kernels.c
+#ifndef _REFERENCE_H_
+#define _REFERENCE_H_
+
+/// day_of_week() summing month lengths in a loop
+uint8_t day_of_week_loop(uint8_t y, uint8_t m, uint8_t d);
+
+/// tobcd16() by division
+uint16_t tobcd16_div(uint16_t x);
+
+/// voltage_getbcd() by division, of the voltage given
+uint16_t voltage_getbcd_div(uint16_t voltage);
+
+#endif
@@ -0,0 +1,204 @@
+///\file tlm2csv.c
+///
+///\brief Decode satashnik telemetry frames to CSV
+///
+/// Opens the serial port, turns telemetry on with a PROTO_TELEMETRY 
+/// command frame and writes every PROTO_TLM frame received as a CSV line 
+/// on stdout. Frames with a bad CRC are counted and skipped. Telemetry is 
+/// turned off again on SIGINT. With "-" instead of a port, a captured 
+/// stream is decoded from stdin.
+///
+/// Usage: tlm2csv /dev/ttyUSB0|- [period]
+///
+/// period is in main loop passes of 1.6 ms, default 16 (~40 frames/s). 
+/// At 19200 bit/s a frame takes ~12 ms, so periods below 8 lose frames.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "../proto.h"
+
+#define BAUDRATE    B19200
+
+/// TELEMETRY field offsets, the firmware struct is packed little-endian
+enum _tlm_offset {
+    T_TAG = 0,
+    T_SEQ = 1,
+    T_XBITS = 2,
+    T_REGULATOR = 3,
+    T_VOLTAGE = 4,
+    T_SETPOINT = 6,
+    T_OCR1A = 8,
+    T_ICR1 = 10,
+    T_DISPLAY = 12,
+    T_BLINKCTR = 14,
+    T_PERSEC = 16,
+    T_SLOWCTR = 18,
+    T_SIZE = 19,
+    // firmware built with PROFILE
+    T_T0MAX = 19,
+    T_T0LATENCY = 20,
+    T_ADCMAX = 21,
+    T_ADCJITTER = 22,
+    T_RXCMAX = 23,
+    T_SIZE_PROFILE = 24
+};
+
+/// ADC units to volts: 1024 units = 500V, see voltage_getbcd()
+#define VOLTS(u)    ((u) * 500.0 / 1024.0)
+
+static volatile sig_atomic_t stop;
+
+static void on_sigint(int sig) {
+    stop = 1;
+}
+
+static uint8_t crc8_update(uint8_t crc, uint8_t data) {
+    int i;
+
+    // Dallas/iButton, same as avr-libc _crc_ibutton_update()
+    crc ^= data;
+    for (i = 0; i < 8; i++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0x8c : crc >> 1;
+    }
+    return crc;
+}
+
+static void send_frame(int fd, const uint8_t *payload, uint8_t len) {
+    uint8_t frame[PROTO_MAX + 3];
+    uint8_t crc = crc8_update(0, len);
+    int i;
+
+    frame[0] = PROTO_SYNC;
+    frame[1] = len;
+    for (i = 0; i < len; i++) {
+        frame[2 + i] = payload[i];
+        crc = crc8_update(crc, payload[i]);
+    }
+    frame[2 + len] = crc;
+    if (write(fd, frame, len + 3) != len + 3) {
+        perror("tlm2csv: write");
+    }
+}
+
+static void telemetry(int fd, uint16_t period) {
+    uint8_t cmd[3] = { PROTO_TELEMETRY, period & 0377, period >> 8 };
+
+    send_frame(fd, cmd, sizeof(cmd));
+}
+
+static int open_port(const char *path) {
+    struct termios tio;
+    int fd = open(path, O_RDWR | O_NOCTTY);
+
+    if (fd < 0 || tcgetattr(fd, &tio) != 0) {
+        perror(path);
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, BAUDRATE);
+    cfsetospeed(&tio, BAUDRATE);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tio);
+    tcflush(fd, TCIOFLUSH);
+
+    return fd;
+}
+
+static unsigned u16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static void print_frame(const uint8_t *t, uint8_t len) {
+    unsigned v = u16(t + T_VOLTAGE);
+    int xbits = t[T_XBITS];
+
+    printf("%u,%u,%.2f,%u,%.2f,%u,%u,%u,%04x,%u,%u,%u",
+           t[T_SEQ], v, VOLTS((double)v / (1 << xbits)),
+           u16(t + T_SETPOINT), VOLTS((double)u16(t + T_SETPOINT)),
+           t[T_REGULATOR], u16(t + T_OCR1A), u16(t + T_ICR1),
+           u16(t + T_DISPLAY), u16(t + T_BLINKCTR), u16(t + T_PERSEC), t[T_SLOWCTR]);
+    if (len >= T_SIZE_PROFILE) {
+        printf(",%u,%u,%u,%u,%u", t[T_T0MAX], t[T_T0LATENCY], t[T_ADCMAX], t[T_ADCJITTER], t[T_RXCMAX]);
+    } else {
+        printf(",,,,,");
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    enum { SYNC, LEN, DATA, CRC } state = SYNC;
+    uint8_t buf[PROTO_MAX], len = 0, pos = 0, crc = 0, c;
+    unsigned crc_errors = 0, frames = 0;
+    int fd, port;
+    struct sigaction sa;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s /dev/ttyXXX|- [period]\n", argv[0]);
+        return 1;
+    }
+
+    port = strcmp(argv[1], "-") != 0;
+    fd = port ? open_port(argv[1]) : 0;
+
+    // no SA_RESTART, so that SIGINT interrupts read()
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigint;
+    sigaction(SIGINT, &sa, NULL);
+    if (port) {
+        telemetry(fd, argc > 2 ? atoi(argv[2]) : 16);
+    }
+
+    printf("seq,voltage_raw,voltage,setpoint_raw,setpoint,regulator,ocr1a,icr1,display,blinkctr,persec,slowctr,t0max,t0latency,adcmax,adcjitter,rxcmax\n");
+
+    while (!stop && read(fd, &c, 1) == 1) {
+        switch (state) {
+        case SYNC:
+            if (c == PROTO_SYNC) state = LEN;
+            break;
+        case LEN:
+            if (c == 0 || c > PROTO_MAX) {
+                state = SYNC;
+                break;
+            }
+            len = c;
+            pos = 0;
+            crc = crc8_update(0, c);
+            state = DATA;
+            break;
+        case DATA:
+            buf[pos++] = c;
+            crc = crc8_update(crc, c);
+            if (pos == len) state = CRC;
+            break;
+        case CRC:
+            state = SYNC;
+            if (c != crc) {
+                crc_errors++;
+                break;
+            }
+            if (buf[0] == PROTO_TLM && len >= T_SIZE) {
+                print_frame(buf, len);
+                fflush(stdout);
+                frames++;
+            }
+            break;
+        }
+    }
+
+    if (port) {
+        telemetry(fd, 0);
+        close(fd);
+    }
+    fprintf(stderr, "tlm2csv: %u frames, %u CRC errors\n", frames, crc_errors);
+
+    return 0;
+}
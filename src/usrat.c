@@ -1,20 +1,29 @@
 //! \file
 //! \brief USART interface
 
-#include <stdio.h>
+#include <stdarg.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
 #include "usrat.h"
+#include "profile.h"
+#include "sched.h"
+#include "hal.h"
 
 static uint8_t rx_buffer[RX_BUFFER_SIZE];
 static volatile uint8_t rx_buffer_in;
 static volatile uint8_t rx_buffer_out;
+static volatile uint16_t rx_overruns;		//!< characters lost to RX buffer or USART data overrun
+static volatile uint16_t rx_frame_errors;	//!< characters received with a bad stop bit
 
-//! \brief a stub to use when usart is disabled
-static void uart_non(char data) {
-}
+static uint8_t tx_buffer[TX_BUFFER_SIZE];
+static volatile uint8_t tx_buffer_in;
+static volatile uint8_t tx_buffer_out;
+static uint16_t tx_dropped;					//!< binary bytes lost to TX buffer overflow
+static uint8_t tx_peak;						//!< max TX buffer fill seen
 
-//! \brief Initialize USART, perform fdevopen with uart_putchar.
+//! \brief Initialize USART, text goes out through uart_putchar() and uart_printf_P().
 //! \param baudval (F_CPU/(16*baudrate))-1
 //! \sa uart_putchar()
 void usart_init(uint16_t baudval) {
@@ -23,39 +32,210 @@ void usart_init(uint16_t baudval) {
 	UBRRL = (uint8_t)baudval;
 
 	rx_buffer_in = rx_buffer_out = 0;
+	tx_buffer_in = tx_buffer_out = 0;
 
 	// Set frame format: 8 data, 1 stop bit
 	UCSRC = (uint8_t)((1<<URSEL) | (0<<USBS) | (3<<UCSZ0));
 	
 	// Enable receiver and transmitter, enable RX complete interrupt
 	UCSRB = (uint8_t)((1<<RXEN) | (1<<TXEN) | (1<<RXCIE));
-
-	(void)fdevopen(uart_putchar, NULL/*, 0*/);
 }
 
-//! \brief Disable USART completely
+//! \brief Disable USART completely, text output is discarded
 void usart_stop() {
     UCSRB = 0;
-    (void)fdevopen(uart_non,NULL);
 }
 
-//! \brief putchar() for USART.
+//! \brief Put a character into TX buffer and let USART_UDRE_vect send it.
+//! \param wait when the buffer is full, wait for room instead of dropping the character
+static void uart_queue(uint8_t data, uint8_t wait) {
+	uint8_t next = (tx_buffer_in + 1) % TX_BUFFER_SIZE;
+	uint8_t depth;
+
+	if (next == tx_buffer_out) {
+		if (!wait) {
+			tx_dropped++;
+			return;
+		}
+		if (SREG & _BV(SREG_I)) {
+			// USART_UDRE_vect makes room and wakes us up
+			while (next == tx_buffer_out) {
+				hal_sleep();
+			}
+		} else {
+			// interrupts are off, drain one character by hand
+			while (!(UCSRA & (1<<UDRE))) {};
+			UDR = tx_buffer[tx_buffer_out];
+			tx_buffer_out = (tx_buffer_out + 1) % TX_BUFFER_SIZE;
+		}
+	}
+
+	tx_buffer[tx_buffer_in] = data;
+	tx_buffer_in = next;
+
+	depth = (uint8_t)(tx_buffer_in - tx_buffer_out) % TX_BUFFER_SIZE;
+	if (depth > tx_peak) {
+		tx_peak = depth;
+	}
+
+	UCSRB |= (1<<UDRIE);
+}
+
+//! \brief putchar() for USART. Waits for room in TX buffer unless 
+//! TX_OVERFLOW is TX_OVERFLOW_DROP, so console text comes out whole.
 //! \param data character to print.
 int uart_putchar(char data) {
-	//while (!(UCSRA & (1<<UDRE))) {};
+	if (!(UCSRB & (1<<TXEN))) {
+		return 0;
+	}
 	if (data == '\n') {
-		(void)uart_putchar('\r');
+		uart_queue('\r', TX_OVERFLOW == TX_OVERFLOW_BLOCK);
 	}
 
-	//PORTD |= 1<<5;
-	while (!(UCSRA & (1<<UDRE))) {};
-	//PORTD &= (uint8_t)(~(1<<5));
-
-	UDR = (uint8_t)data;
+	uart_queue((uint8_t)data, TX_OVERFLOW == TX_OVERFLOW_BLOCK);
 
 	return 0;
 }
 
+//! \brief Print x in base, at least width digits padded with pad
+static void uart_putnum(uint16_t x, uint8_t base, uint8_t width, char pad) {
+	char digits[5];
+	uint8_t n = 0, d;
+
+	do {
+		d = x % base;
+		digits[n++] = d < 10 ? '0' + d : 'a' - 10 + d;
+		x /= base;
+	} while (x != 0);
+
+	while (width > n) {
+		uart_putchar(pad);
+		width--;
+	}
+	while (n != 0) {
+		uart_putchar(digits[--n]);
+	}
+}
+
+//! \brief printf_P() for the little the firmware prints, without vfprintf.
+//! Conversions: %d %u %x with optional 0 flag and width digit,
+//! %s string, %S string in program memory, %%.
+//! \param fmt format string in program memory
+void uart_printf_P(const char *fmt, ...) {
+	va_list ap;
+	char c, pad;
+	uint8_t width;
+	int16_t i;
+	const char *str;
+
+	va_start(ap, fmt);
+	while ((c = pgm_read_byte(fmt++)) != 0) {
+		if (c != '%') {
+			uart_putchar(c);
+			continue;
+		}
+
+		c = pgm_read_byte(fmt++);
+		pad = ' ';
+		if (c == '0') {
+			pad = '0';
+			c = pgm_read_byte(fmt++);
+		}
+		width = 0;
+		if (c >= '1' && c <= '9') {
+			width = c - '0';
+			c = pgm_read_byte(fmt++);
+		}
+
+		switch (c) {
+			case 'd':
+				i = va_arg(ap, int);
+				if (i < 0) {
+					uart_putchar('-');
+					i = -i;
+				}
+				uart_putnum((uint16_t)i, 10, width, pad);
+				break;
+			case 'u':
+				uart_putnum((uint16_t)va_arg(ap, int), 10, width, pad);
+				break;
+			case 'x':
+				uart_putnum((uint16_t)va_arg(ap, int), 16, width, pad);
+				break;
+			case 's':
+				str = va_arg(ap, const char *);
+				while (*str) {
+					uart_putchar(*str++);
+				}
+				break;
+			case 'S':
+				str = va_arg(ap, const char *);
+				while ((c = pgm_read_byte(str++)) != 0) {
+					uart_putchar(c);
+				}
+				break;
+			case 0:
+				fmt--;
+				break;
+			default:
+				uart_putchar(c);
+				break;
+		}
+	}
+	va_end(ap);
+}
+
+//! \brief Put a byte into TX buffer as is, for binary data. Never waits, 
+//! a byte that doesn't fit is dropped and counted.
+void uart_putbyte(uint8_t data) {
+	uart_queue(data, 0);
+}
+
+//! \brief Wait until n bytes fit in TX buffer, so that a frame goes out whole.
+//! Returns at once when interrupts are off or the transmitter is disabled.
+void uart_tx_wait(uint8_t n) {
+	while (uart_tx_free() < n && (UCSRB & (1<<TXEN)) && (SREG & _BV(SREG_I))) {
+		hal_sleep();
+	}
+}
+
+//! \brief Number of binary bytes dropped because TX buffer was full
+uint16_t uart_tx_dropped() {
+	return tx_dropped;
+}
+
+//! \brief Room left in TX buffer
+uint8_t uart_tx_free() {
+	return TX_BUFFER_SIZE - 1 - (uint8_t)(tx_buffer_in - tx_buffer_out) % TX_BUFFER_SIZE;
+}
+
+//! \brief Peak TX buffer fill since boot
+uint8_t uart_tx_peak() {
+	return tx_peak;
+}
+
+//! \brief Number of received characters lost to overruns
+uint16_t uart_rx_overruns() {
+	uint16_t n;
+	
+	cli();
+	n = rx_overruns;
+	sei();
+	
+	return n;
+}
+
+//! \brief Number of characters received with framing errors
+uint16_t uart_rx_frame_errors() {
+	uint16_t n;
+	
+	cli();
+	n = rx_frame_errors;
+	sei();
+	
+	return n;
+}
+
 //! \brief getchar() for USART. Wait for data if not available.
 //! \return value read.
 //! \sa uart_available()
@@ -80,8 +260,38 @@ uint8_t uart_getc() {
 }
 
 ISR(USART_RXC_vect) {
-	rx_buffer[rx_buffer_in] = (uint8_t)UDR;
-	rx_buffer_in = (rx_buffer_in + 1) % RX_BUFFER_SIZE;
+	prof_enter();
+	uint8_t status = UCSRA;					// must be read before UDR
+	uint8_t data = UDR;
+	uint8_t next = (rx_buffer_in + 1) % RX_BUFFER_SIZE;
+
+	if (status & (1<<DOR)) {
+		rx_overruns++;
+	}
+	if (status & (1<<FE)) {
+		rx_frame_errors++;
+		prof_exit(PROF_RXC);
+		return;
+	}
+	if (next == rx_buffer_out) {
+		rx_overruns++;
+		prof_exit(PROF_RXC);
+		return;
+	}
+
+	rx_buffer[rx_buffer_in] = data;
+	rx_buffer_in = next;
+	sched_signal_isr(SCHED_UART);
+	prof_exit(PROF_RXC);
+}
+
+ISR(USART_UDRE_vect) {
+	UDR = tx_buffer[tx_buffer_out];
+	tx_buffer_out = (tx_buffer_out + 1) % TX_BUFFER_SIZE;
+
+	if (tx_buffer_out == tx_buffer_in) {
+		UCSRB &= ~(1<<UDRIE);
+	}
 }
 
 // $Id: usrat.c 7 2009-11-15 18:21:34Z svofski $
@@ -3,16 +3,38 @@
 #ifndef _USRAT_H
 #define _USRAT_H
 
-#define RX_BUFFER_SIZE	4					//!< USART RX buffer length
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE	64					//!< USART RX buffer length, power of 2
+#endif
+
+#ifndef TX_BUFFER_SIZE
+#define TX_BUFFER_SIZE	64					//!< USART TX buffer length, power of 2
+#endif
+
+#define TX_OVERFLOW_DROP	0				//!< drop characters that don't fit, count them
+#define TX_OVERFLOW_BLOCK	1				//!< wait for the TX buffer to drain
+
+#ifndef TX_OVERFLOW
+#define TX_OVERFLOW		TX_OVERFLOW_BLOCK	//!< what uart_putchar() does when TX buffer is full, uart_putbyte() always drops
+#endif
 
 void usart_init(uint16_t baudrate);
 void usart_stop();
 
 int uart_putchar(char data);
+void uart_printf_P(const char *fmt, ...);
+void uart_putbyte(uint8_t data);
 int uart_getchar();
 uint8_t uart_available(void);
 uint8_t uart_getc();
 
+uint16_t uart_tx_dropped();
+uint8_t uart_tx_peak();
+uint8_t uart_tx_free();
+void uart_tx_wait(uint8_t n);
+uint16_t uart_rx_overruns();
+uint16_t uart_rx_frame_errors();
+
 #endif
 
 // $Id: usrat.h 6 2009-11-14 18:10:22Z svofski $
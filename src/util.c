@@ -1,4 +1,5 @@
 #include <inttypes.h>
+#include <avr/pgmspace.h>
 #include "util.h"
 
 uint8_t frombcd(uint8_t x) {
@@ -11,12 +12,7 @@ uint8_t month_length(uint8_t m, uint8_t leap) {
 }
 
 uint8_t days_in_month_bcd(uint8_t year, uint8_t month) {
-    uint8_t y = frombcd(year);//(year & 7) + ((year & 070)>>3) * 10;
-    uint8_t m = frombcd(month);//(month & 7) + ((month & 070)>>3) * 10;
-    uint8_t leap = y % 4 == 0; // non y2k1-compliant, but should be correct for the next 91 years or so :)
-    
-    uint8_t knuckle = m < 8 ? (m & 1) == 1 : (m & 1) == 0;
-    return knuckle ? 0x31 : m != 2 ? 0x30 : leap ? 0x29 : 0x28;
+    return tobcd(month_length(frombcd(month), leap_year(frombcd(year))));
 }
 
 
@@ -30,27 +26,34 @@ uint8_t bcd_increment(uint8_t x) {
 }
 
 
+/// Days before each month in a common year, mod 7
+static const uint8_t month_offset[12] PROGMEM = { 0, 3, 3, 6, 1, 4, 6, 2, 5, 0, 3, 5 };
+
 uint8_t day_of_week(uint8_t y, uint8_t m, uint8_t d) {
-    uint8_t leap = y%4 == 0;
-    uint16_t centurydays = 6 + y * 365 + (y+3)/4; // year 2000 started on Saturday
-    for (; --m >= 1; ) {
-        centurydays += month_length(m,leap);
-    }
+    // 2000-01-01 was a Saturday, a year is 365 = 1 mod 7 days,
+    // (y+3)/4 leap days went by before year y. Sum stays below 256.
+    uint8_t days = 6 + y + ((y + 3) >> 2) + pgm_read_byte(&month_offset[m - 1]) + d - 1;
     
-    centurydays += d-1;
+    if (m > 2 && leap_year(y)) {
+        days++;
+    }
     
-    return (centurydays % 7);
+    return days % 7;
 }
 
 uint16_t tobcd16(uint16_t x) {
-    uint16_t y;
+    // reciprocal multiplies, exact for x < 1000 and r < 100
+    uint8_t h = (x * 41) >> 12;                 // x / 100
+    uint8_t r = x - h * 100;
+    uint8_t t = ((uint16_t) r * 103) >> 10;     // r / 10
     
-    y  = x % 10;        x /= 10;       
-    y |= (x % 10)<<4;   x /= 10;
-    y |= (x % 100)<<8;  x /= 10; 
-    y |= 0xf000;
+    return 0xf000 | (h << 8) | (t << 4) | (r - t * 10);
+}
+
+uint8_t tobcd(uint8_t x) {
+    uint8_t t = ((uint16_t) x * 103) >> 10;     // x / 10, exact for x < 100
     
-    return y;
+    return (t << 4) | (x - t * 10);
 }
 
 
@@ -9,6 +9,20 @@
 #define PORTDIGIT PORTC
 #define DDRDIGIT  DDRC
 
+/// ID1 (K155ID1/74141) input bit wired to each bit of a BCD digit on PORTDIGIT.
+/// Change these to match the board, the digit code table follows.
+#define CATHODE_B0  3
+#define CATHODE_B1  1
+#define CATHODE_B2  0
+#define CATHODE_B3  2
+
+/// Schematic-ordered cathode code of a BCD nibble, compile-time
+#define RAWNIBBLE(n) ((((n) & 1) << CATHODE_B0) | ((((n) >> 1) & 1) << CATHODE_B1) |\
+                      ((((n) >> 2) & 1) << CATHODE_B2) | ((((n) >> 3) & 1) << CATHODE_B3))
+
+/// Schematic-ordered cathode codes of a packed BCD byte, compile-time
+#define RAWBYTE(b)   ((RAWNIBBLE(((b) >> 4) & 017) << 4) | RAWNIBBLE((b) & 017))
+
 #define PORTBUTTON PORTC
 #define DDRBUTTON  DDRC
 
@@ -17,6 +31,14 @@
 #define PORTSA1    PORTB
 #define DDRSA1     DDRB
 
+/// Anodes stay off for this many Timer0 ticks (25us each) between digits
+/// to prevent ghosting. Must end before the first early blanking slot.
+#define ANODE_BLANK_TICKS   1
+
+#if ANODE_BLANK_TICKS < 1 || ANODE_BLANK_TICKS >= 8
+#error ANODE_BLANK_TICKS must be 1..7
+#endif
+
 #define PORTDOT     PORTD
 #define DDRDOT      DDRD
 #define DOT         3
@@ -46,14 +68,24 @@ enum _sa_values {
 
 /// Convert to binary from BCD representation 
 /// \see frombcd
-#define _frombcd(x) ((x & 017) + (((x) & 0160)>>4) * 10)
+#define _frombcd(x) (((x) & 017) + (((x) & 0360)>>4) * 10)
 
 /// Convert to binary from BCD representation as a function.
 /// \see _frombcd
 uint8_t frombcd(uint8_t);
 
+/// Convert 0..999 to 3-digit BCD, the top digit is 0xf (blank)
 uint16_t tobcd16(uint16_t);
 
+/// Convert 0..99 to 2-digit BCD
+uint8_t tobcd(uint8_t);
+
+/// 1 if binary year since 2000 is a leap year, valid for 2000-2099
+#define leap_year(y) (((y) & 3) == 0)
+
+/// Return count of days in binary month m, leap is 1 in leap years
+uint8_t month_length(uint8_t m, uint8_t leap);
+
 /// Return BCD count of days in month for given BCD year and month.
 /// Valid only for years 2000-2099.
 uint8_t days_in_month_bcd(uint8_t year, uint8_t month);
@@ -61,7 +93,7 @@ uint8_t days_in_month_bcd(uint8_t year, uint8_t month);
 /// Increment BCD value by 1
 uint8_t bcd_increment(uint8_t x);
 
-/// Get day of week, 0 = Sunday. Input parameters are binary (not BCD)
+/// Get day of week, 0 = Sunday. Input parameters are binary (not BCD), m is 1..12
 uint8_t day_of_week(uint8_t y, uint8_t m, uint8_t d);
 
 /// Set blinkmode
@@ -70,15 +102,19 @@ void blinkmode_set(uint8_t mode);
 /// Get blinkmode
 uint8_t blinkmode_get();
 
-/// Called every blink, unless NULL
-void (*blinkhandler)(uint8_t);
-
 /// Sets fading mode and speed
 /// \see _fademode
 void fade_set(uint8_t mode);
 
 void fadeto(uint16_t t);
 
+extern volatile uint16_t blinkctr;  //!< slow cycles since the second began
+extern volatile uint8_t slowctr;    //!< slow cycle counter
+extern uint16_t secmeasured;        //!< slow cycles in the last RTC second
+
+/// Show value instead of time for given number of seconds, 0 to release
+void display_override(uint16_t value, uint8_t seconds);
+
 uint16_t get_display_value();
 
 /// Cycle display modes
@@ -92,6 +128,7 @@ uint8_t mode_get();
 void savingmode_set(uint8_t s);
 uint8_t savingmode_get();
 void savingmode_next();
+uint8_t savingmode_dark(uint16_t hhmm);
 
 // see dot blinking mode
 // \see _dotmode
@@ -3,14 +3,31 @@
 #include <avr/interrupt.h>
 #include "voltage.h"
 #include "util.h"
+#include "profile.h"
 
 #include <stdio.h>
 
 volatile uint16_t voltage;                            //!< voltage (magic units)
+static volatile uint16_t voltage_hr;                  //!< voltage with VOLTAGE_XBITS extra bits
 static volatile uint16_t voltage_setpoint = VOLTAGE_WASTE;   //!< voltage setpoints (magic units)
+static volatile uint16_t voltage_ramp;                      //!< soft start setpoint, climbs to voltage_setpoint
+static volatile uint8_t ramping;                            //!< soft start is on, cleared when voltage_ramp gets there
+static uint16_t voltage_levels[NVOLTAGELEVELS] = { VOLTAGE_WASTE, VOLTAGE_SAVE };
 
 static const uint16_t ocr1a_reload = 121;
 
+static volatile uint8_t regulator = REGULATOR;  //!< \see _regulator
+static volatile uint8_t pi_kp = PI_KP;
+static volatile uint8_t pi_ki = PI_KI;
+static int16_t pi_integral;                     //!< PI integrator, OCR1A << PI_FRAC
+
+static VOLTAGE_STATS stats;
+static uint16_t settle_ctr;                     //!< regulator steps since setpoint change
+static uint8_t settle_inband;                   //!< regulator steps within band in a row
+
+/// PI works on voltage_hr, so its gains are scaled down by extra bits
+#define PI_FRAC (PI_SHIFT + VOLTAGE_XBITS)
+
 void pump_init() {
     // set fast pwm mode
     // COM1A1:0 = 10, clear oc1a on compare match, set at top
@@ -42,46 +59,209 @@ void pump_faster(int8_t dfreq) {
 }
 
 void adc_init() {
-    voltage = 0;
+    voltage = voltage_hr = 0;
+    voltage_ramp = 0;
+    ramping = 1;
     
     // PORTA.7 is the feedback input, AREF = AREF pin
     ADMUX = 7;  
     //DDRA &= ~_BV(7);
 
-    // ADC enable, autotrigger, interrupt enable, prescaler = 111 (divide by 32)
-    ADCSRA = BV6(ADEN, ADFR, ADIE, ADPS2, ADPS1, ADPS0); 
-    //ADCSRA = BV5(ADEN, ADIE, ADPS2, ADPS1, ADPS0); 
-
+#ifdef ADC_QUIET_SYNC
+    // single conversions started by adc_quiet_start()
+    ADCSRA = ADC_CONTROL;
+#else
+    // free running
+    ADCSRA = ADC_CONTROL | _BV(ADFR);
     ADCSRA |= _BV(ADSC); 
+#endif
 }
 
-/// Start voltage booster
+/// Start voltage booster. 
+/// The setpoint is approached gradually from the voltage present on the HV rail, 
+/// one unit per VOLTAGE_RAMP regulator steps. Later setpoint changes are 
+/// followed right away.
 void voltage_start() {
     adc_init();
     pump_init();
 }
 
 uint16_t voltage_getbcd() {
-    // 1024 = 500V
-    uint16_t val = (voltage * 32) / 65;
-    return tobcd16(val);
+    // 1024 = 500V, 32264/65536 is 32/65 rounded up, exact for 0..1023.
+    // Only the high word of voltage * 32264 is needed: 8x8 multiplies
+    // of the bytes, 32264 = 0x7e08, no 32-bit __mulsi3.
+    uint16_t v = voltage;
+    uint8_t lo = v, hi = v >> 8;                // hi < 4
+    uint16_t mid = hi * 0x08 + (uint16_t) lo * 0x7e + (((uint16_t) lo * 0x08) >> 8);
+    
+    return tobcd16(hi * 0x7e + (mid >> 8));
 }
 
 inline uint16_t voltage_get() {
     return voltage;
 }
 
+/// Get voltage with VOLTAGE_XBITS extra bits from oversampling
+uint16_t voltage_get_hr() {
+    uint16_t v;
+    
+    cli();
+    v = voltage_hr;
+    sei();
+    
+    return v;
+}
+
 void voltage_set(uint16_t setpoint) {
-    voltage_setpoint = setpoint;
+    if (setpoint != voltage_setpoint) {
+        cli();
+        voltage_setpoint = setpoint;
+        settle_ctr = 0;
+        settle_inband = 0;
+        stats.settle = 0;
+        stats.overshoot = 0;
+        sei();
+    }
 }
 
 inline uint16_t voltage_setpoint_get() { return voltage_setpoint; }
 
+/// Change setpoint for a saving level, \see _voltage_level. 
+/// \return 0 if level or setpoint is out of range
+uint8_t voltage_level_set(uint8_t level, uint16_t setpoint) {
+    if (level >= NVOLTAGELEVELS || setpoint > VOLTAGE_LIMIT) {
+        return 0;
+    }
+    voltage_levels[level] = setpoint;
+    return 1;
+}
+
+uint16_t voltage_level_get(uint8_t level) {
+    return voltage_levels[level];
+}
+
+/// Select bang-bang or PI regulator, \see _regulator
+void voltage_regulator_set(uint8_t mode) {
+    cli();
+    regulator = mode;
+    pi_integral = OCR1A << PI_FRAC;     // bumpless
+    sei();
+}
+
+uint8_t voltage_regulator_get() { return regulator; }
+
+/// Set PI gains, fixed point with PI_SHIFT fractional bits, per voltage unit
+void voltage_pi_set(uint8_t kp, uint8_t ki) {
+    pi_kp = kp;
+    pi_ki = ki;
+}
+
+uint8_t voltage_kp_get() { return pi_kp; }
+
+uint8_t voltage_ki_get() { return pi_ki; }
+
+/// Get settling time, overshoot and ripple measurements
+void voltage_stats_get(VOLTAGE_STATS *s) {
+    cli();
+    *s = stats;
+    sei();
+}
+
+/// One step of PI regulator
+/// \param error setpoint - voltage_hr
+/// \return OCR1A value
+static inline uint8_t pi_update(int16_t error) {
+    int32_t acc;
+    
+    acc = pi_integral + (int32_t)pi_ki * error;
+    if (acc < 0) {
+        acc = 0;
+    } else if (acc > (ocr1a_reload << PI_FRAC)) {
+        acc = ocr1a_reload << PI_FRAC;
+    }
+    pi_integral = acc;
+    
+    acc = ((int32_t)pi_kp * error + pi_integral) >> PI_FRAC;
+    if (acc < 0) return 0;
+    if (acc > ocr1a_reload) return ocr1a_reload;
+    return acc;
+}
+
+/// Track settling after setpoint change and ripple
+static inline void measure(uint16_t v) {
+    static uint16_t vmin = 0xffff, vmax;
+    static uint8_t windowctr;
+    
+    if (v < vmin) vmin = v;
+    if (v > vmax) vmax = v;
+    if (++windowctr == (uint8_t)VOLTAGE_RIPPLE_WINDOW) {
+        stats.ripple = vmax - vmin;
+        vmin = 0xffff;
+        vmax = 0;
+    }
+    
+    if (stats.settle == 0 && settle_ctr != 0xffff) {
+        settle_ctr++;
+        if (v > voltage_setpoint && v - voltage_setpoint > stats.overshoot) {
+            stats.overshoot = v - voltage_setpoint;
+        }
+        if (v + VOLTAGE_SETTLE_BAND >= voltage_setpoint && v <= voltage_setpoint + VOLTAGE_SETTLE_BAND) {
+            if (++settle_inband == VOLTAGE_SETTLE_HOLD) {
+                stats.settle = settle_ctr - VOLTAGE_SETTLE_HOLD + 1;
+            }
+        } else {
+            settle_inband = 0;
+        }
+    }
+}
+
 ISR(ADC_vect) {
-    voltage = (voltage + ADC) / 2;
-    if (voltage < voltage_setpoint) {
+    prof_enter();
+    static uint8_t rampctr;
+    uint16_t target = voltage_setpoint;
+#if ADC_OVERSAMPLE_LOG2 > 0
+    static uint16_t acc;
+    static uint8_t nacc;
+    
+    // boxcar: sum 2^ADC_OVERSAMPLE_LOG2 conversions, then decimate
+    acc += ADC;
+    if (++nacc != (1 << ADC_OVERSAMPLE_LOG2)) {
+        prof_exit(PROF_ADC);
+        return;
+    }
+    voltage_hr = acc >> (ADC_OVERSAMPLE_LOG2 - VOLTAGE_XBITS);
+    acc = 0;
+    nacc = 0;
+#else
+    voltage_hr = ADC;
+#endif
+    voltage = (voltage_hr + ((1 << VOLTAGE_XBITS) >> 1)) >> VOLTAGE_XBITS;
+    
+    if (ramping) {
+        if (voltage_ramp == 0) {
+            // resume from whatever is left on the HV rail, e.g. after a warm reset
+            voltage_ramp = voltage;
+        }
+        
+        if (voltage_ramp >= target) {
+            ramping = 0;
+        } else {
+            if (++rampctr == VOLTAGE_RAMP) {
+                rampctr = 0;
+                voltage_ramp++;
+            }
+            target = voltage_ramp;
+        }
+    }
+    
+    if (regulator == REG_PI) {
+        OCR1A = pi_update((target << VOLTAGE_XBITS) - voltage_hr);
+    } else if (voltage_hr < (target << VOLTAGE_XBITS)) {
         OCR1A = ocr1a_reload;
     } else {
         OCR1A = 0;
     }
+    
+    measure(voltage);
+    prof_exit(PROF_ADC);
 }
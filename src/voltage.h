@@ -10,6 +10,70 @@
 
 #define VOLTAGE_WASTE   370                     //!< ~180V
 #define VOLTAGE_SAVE    355                     //!< ~170V
+#define VOLTAGE_LIMIT   390                     //!< ~190V, higher setpoints are refused
+
+/// Setpoints selected by saving modes, adjustable at runtime
+enum _voltage_level {
+    VOLTAGE_LEVEL_WASTE = 0,                    //!< VOLTAGE_WASTE at startup
+    VOLTAGE_LEVEL_SAVE,                         //!< VOLTAGE_SAVE at startup
+    NVOLTAGELEVELS
+};
+
+#define VOLTAGE_RAMP    1                       //!< soft start: regulator steps per setpoint unit, ~0.3s to full at 4x
+
+/// ADC conversions per regulator step, log2: 0, 2 (4x, +1 bit) or 4 (16x, +2 bits).
+/// Boxcar sum decimated to VOLTAGE_XBITS extra bits of resolution.
+/// Free-running conversions are at 4.8kHz, so with 4x the regulator steps 
+/// at 1.2kHz. ADC_QUIET_SYNC starts conversions at 5kHz, 1.25kHz steps with 4x.
+#define ADC_OVERSAMPLE_LOG2 2
+
+#define VOLTAGE_XBITS   (ADC_OVERSAMPLE_LOG2/2) //!< extra bits in voltage_get_hr()
+
+/// Start conversions from Timer0 in the middle of multiplex phases, 
+/// so that samples never land on anode transitions. Free-running otherwise.
+//#define ADC_QUIET_SYNC
+
+#ifdef ADC_QUIET_SYNC
+/// ADC enable, interrupt enable, prescaler = 110: clk/64 = 125kHz, 
+/// 104us per conversion, done before the next start 200us later
+#define ADC_CONTROL     BV4(ADEN, ADIE, ADPS2, ADPS1)
+
+/// Start a conversion, called by TIMER0_OVF_vect in a quiet slot.
+/// ADCSRA is written, not or'ed, so that a pending ADIF is not cleared.
+#define adc_quiet_start() { if (ADCSRA & _BV(ADEN)) ADCSRA = ADC_CONTROL | _BV(ADSC); }
+#else
+/// ADC enable, interrupt enable, prescaler = 111: clk/128 = 62.5kHz, 4.8kHz free-running
+#define ADC_CONTROL     (BV4(ADEN, ADIE, ADPS2, ADPS1) | _BV(ADPS0))
+#endif
+
+/// Regulator modes
+enum _regulator {
+    REG_BANGBANG = 0,       //!< OCR1A is either full or 0
+    REG_PI,                 //!< fixed-point PI, OCR1A modulated continuously
+};
+
+#define REGULATOR       REG_BANGBANG            //!< regulator mode at startup
+
+#define PI_SHIFT        6                       //!< PI gains are fixed-point with this many fractional bits
+#define PI_KP           16                      //!< default proportional gain, OCR1A counts per unit << PI_SHIFT
+/// Default integral gain per regulator step, tuned as 2 at 4.8kHz steps 
+/// and scaled to the step rate to keep the gain per second
+#ifdef ADC_QUIET_SYNC
+#define PI_KI           (((96 << ADC_OVERSAMPLE_LOG2) + 25) / 50)
+#else
+#define PI_KI           (2 << ADC_OVERSAMPLE_LOG2)
+#endif
+
+#define VOLTAGE_SETTLE_BAND 3                   //!< settled when within this many units of setpoint...
+#define VOLTAGE_SETTLE_HOLD 64                  //!< ...for this many regulator steps in a row
+#define VOLTAGE_RIPPLE_WINDOW 256               //!< ripple is measured over this many regulator steps
+
+/// Regulator performance, in regulator steps and voltage units
+typedef struct _voltage_stats {
+    uint16_t settle;        //!< steps from last setpoint change until settled, 0 while not settled
+    uint16_t overshoot;     //!< max excess over setpoint since last setpoint change
+    uint16_t ripple;        //!< peak-to-peak over last VOLTAGE_RIPPLE_WINDOW conversions
+} VOLTAGE_STATS;
 
 
 /// Start voltage booster
@@ -21,10 +85,23 @@ void pump_nomoar();
 
 uint16_t voltage_get();
 
+uint16_t voltage_get_hr();
+
 uint16_t voltage_getbcd();
 
 void voltage_set(uint16_t setpoint);    //!< set voltage setpoint
 
 uint16_t voltage_setpoint_get();
 
+uint8_t voltage_level_set(uint8_t level, uint16_t setpoint);
+uint16_t voltage_level_get(uint8_t level);
+
+void voltage_regulator_set(uint8_t mode);
+uint8_t voltage_regulator_get();
+void voltage_pi_set(uint8_t kp, uint8_t ki);
+uint8_t voltage_kp_get();
+uint8_t voltage_ki_get();
+
+void voltage_stats_get(VOLTAGE_STATS *stats);
+
 #endif